@@ -1,8 +1,18 @@
 #include "procsim.hpp"
+#include "procsim_bpred.hpp"
+#include <cinttypes>
 #include <cmath>
+#include <algorithm>
 #include <list>
+#include <deque>
+#include <vector>
 #include <iterator>
 #include <fstream>
+#include <chrono>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
@@ -10,67 +20,244 @@ using namespace std;
 // Global Variables //
 //==================//
 
+// simulator state is per host thread so batch runs can simulate in parallel
+
 // log file
 //ofstream log_file;
 
-// instructions
-list<proc_inst_t*> instructions;
+// fetched instructions a refetch or rollback may still reach, the front
+// one has inst_tag instructions_base, older ones were released
+thread_local deque<proc_inst_t*> instructions;
+thread_local uint64_t instructions_base;
+
+// released instructions, reused by fetch
+thread_local vector<proc_inst_t*> inst_pool;
+
+// register file
+thread_local reg_t* reg;
+
+// CPR checkpoints, a ring whose oldest entry holds the committed state and
+// whose others were taken at dispatch, in program order
+thread_local vector<checkpoint_t> checkpoints;
+thread_local unsigned long ckpt_head;
+thread_local unsigned long ckpt_count;
 
-// register file and its backups
-reg_t* reg;
-reg_t* backup_1;
-reg_t* backup_2;
+// inst_tag dispatch takes the next checkpoint at when they follow the
+// scheduling queue tail, UINT64_MAX once it is taken
+thread_local uint64_t ckpt_barrier;
+
+// inst_tag of the youngest instruction dispatched
+thread_local uint64_t dispatch_tag;
+
+// checkpoints kept, including the committed one, and instructions
+// dispatched between two of them, 0 to take each at the scheduling queue
+// tail as the oldest commits
+thread_local uint64_t ckpt_max = DEFAULT_CKPTS;
+thread_local uint64_t ckpt_interval = 0;
+
+// journal of the renames since the committed checkpoint, journal_base is the
+// position of its front, and the epoch each register was last journaled in
+thread_local deque<journal_entry_t> journal;
+thread_local uint64_t journal_base;
+thread_local vector<uint64_t> journal_epoch;
+thread_local uint64_t epoch_counter;
 
 // scoreboard of function units
-list<proc_inst_t*> sb;
+// holds instructions that finished executing and wait for a result bus
+thread_local list<proc_inst_t*> sb;
+
+// execution latency of each FU class and whether it accepts a new instruction
+// every cycle, shared by all host threads and set before any run starts
+uint64_t fu_latency[3] = {1, 1, 1};
+bool fu_pipelined[3] = {true, true, true};
+
+// timing wheel of executing instructions, slot c & wheel_mask holds the
+// ones that finish in cycle c
+thread_local vector<vector<proc_inst_t*>> completions;
+thread_local uint64_t wheel_mask;
+thread_local unsigned long executing;
+
+// instructions that finished this cycle, oldest fired first
+thread_local vector<proc_inst_t*> finished;
+
+// I-cache geometry and miss latency, shared by all host threads, 0 sets for
+// a perfect I-cache
+uint64_t icache_sets = 0;
+uint64_t icache_assoc;
+uint64_t icache_line_bits;
+uint64_t icache_latency;
+
+// I-cache contents, way w of set i at i * icache_assoc + w, with LRU stamps
+// repeated fetches from the last line hit without a lookup and are not counted
+thread_local vector<uint64_t> icache_tags;
+thread_local vector<uint64_t> icache_used;
+thread_local uint64_t icache_last_line;
+
+// line the last miss is filling
+thread_local uint64_t icache_fill_line;
+thread_local uint64_t icache_clock;
+thread_local unsigned long icache_access_counter;
+thread_local unsigned long icache_miss_counter;
+
+// fetch stalls until this cycle while a missing line is filled
+thread_local unsigned long fetch_ready = 0;
+thread_local bool fetch_waiting = false;
+
+// trace instruction read ahead of a miss, fetched once its line arrives
+thread_local proc_inst_t fetch_held;
+thread_local bool fetch_holding = false;
+
+// the trace ran out, fetch only refetches after a flush
+thread_local bool fetch_exhausted = false;
+
+// mispredicted branch fetch waits on, Tomasulo has no way to flush past it
+thread_local proc_inst_t* fetch_blocker = nullptr;
+
+// instructions each pipelined class accepted this cycle
+thread_local unsigned long fu_issued[3];
 
 // result buses
-proc_inst_t** cdb;
+thread_local proc_inst_t** cdb;
 
 // dispatch queue
-list<proc_inst_t*> dq;
-unsigned long dq_size = 0;
-unsigned long dq_max_size = 0;
-unsigned long dq_size_sum = 0;
+thread_local list<proc_inst_t*> dq;
+thread_local unsigned long dq_size = 0;
+thread_local unsigned long dq_max_size = 0;
+thread_local unsigned long dq_size_sum = 0;
+
+// dispatch queue capacity and instructions dispatched per cycle, UINT64_MAX
+// for no limit
+thread_local uint64_t dq_capacity = UINT64_MAX;
+thread_local uint64_t dispatch_width = UINT64_MAX;
 
 // scheduling queue
-list<proc_inst_t*> sq;
-unsigned long sq_size = 0;
-unsigned long sq_max_size;
+thread_local list<proc_inst_t*> sq;
+thread_local unsigned long sq_size = 0;
+thread_local unsigned long sq_max_size;
 
 // reorder buffer
-list<proc_inst_t*> rob;
+thread_local list<proc_inst_t*> rob;
+
+// scheduling queue and reorder buffer sizes asked for, 0 for the defaults
+// of 2 entries per FU and an unbounded reorder buffer
+thread_local uint64_t sq_entries = 0;
+thread_local uint64_t rob_capacity = UINT64_MAX;
+
+// physical register file, 0 for unbounded, else the 128 architectural
+// registers plus the rename registers
+thread_local uint64_t prf_size = 0;
+
+// free physical registers, and per register how many of its producer, the
+// writer replacing it in the map and the CPR journal still hold it, free at 0
+thread_local vector<uint32_t> preg_free;
+thread_local vector<uint8_t> preg_holds;
+
+// physical registers of the architectural state a ROB flush restores
+thread_local vector<uint32_t> arch_preg;
 
 // processor parameters
-uint64_t r;
-uint64_t k[3];
-uint64_t f;
-uint64_t e;
-uint64_t s;
+thread_local uint64_t r;
+thread_local uint64_t k[3];
+thread_local uint64_t f;
+thread_local uint64_t e;
+thread_local uint64_t s;
 
 // counters
-unsigned long inst_tag_counter = 1;
-unsigned long reg_tag_counter = 128;
-unsigned long cycle_counter = 1;
-unsigned long fired_counter = 1;
-unsigned long retired_counter = 1;
-unsigned long flushed_counter = 1;
-unsigned long exception_counter = 1;
-unsigned long backup_counter = 1;
-unsigned long rob_hit_counter = 1;
-unsigned long reg_hit_counter = 1;
-unsigned long fu_busy_counter[3] = {0, 0, 0};
+thread_local unsigned long inst_tag_counter = 1;
+thread_local unsigned long reg_tag_counter = 128;
+thread_local unsigned long cycle_counter = 1;
+thread_local unsigned long fired_counter = 1;
+thread_local unsigned long retired_counter = 1;
+thread_local unsigned long flushed_counter = 1;
+thread_local unsigned long exception_counter = 1;
+thread_local unsigned long backup_counter = 1;
+thread_local unsigned long rob_hit_counter = 1;
+thread_local unsigned long reg_hit_counter = 1;
+thread_local unsigned long fu_busy_counter[3] = {0, 0, 0};
+
+// convergence-based early termination
+thread_local uint64_t conv_interval = 0;
+thread_local double conv_tolerance = DEFAULT_T;
+thread_local uint64_t conv_countdown;
+thread_local unsigned long conv_samples;
+thread_local unsigned long conv_last_retired;
+thread_local double conv_mean;
+thread_local double conv_m2;
+
+// instructions fetched before the run stops reading the trace
+thread_local uint64_t inst_budget = UINT64_MAX;
+
+// per-cycle occupancy telemetry
+thread_local FILE* tele_out = nullptr;
+thread_local uint64_t tele_interval = 0;
+thread_local bool tele_binary;
+thread_local uint64_t tele_countdown;
+thread_local unsigned long tele_last_retired;
+thread_local telemetry_sample_t* tele_ring = nullptr;
+thread_local unsigned long tele_count;
+
+// retire slots lost per cause, for the CPI stack
+thread_local unsigned long stall_slots[NUM_STALL_CAUSES];
+thread_local unsigned long retired_this_cycle;
+thread_local bool sq_full_stall;
+thread_local bool refilling;
+
+// rolling hash of retirement timing
+thread_local uint64_t timing_digest;
 
 // trailing pointer for re-fetches
-unsigned long trailing_inst_tag = 1;
-list<proc_inst_t*>::iterator trailing_ptr = instructions.begin();
-
-// instruction barrier
-proc_inst_t* ib1 = nullptr;
-proc_inst_t* ib2 = nullptr;
+thread_local unsigned long trailing_inst_tag = 1;
 
 // dummy instruction
-proc_inst_t* dummy_inst;
+thread_local proc_inst_t* dummy_inst;
+
+// SMT threads sharing the scheduling queue, FUs, result buses, register
+// file, I-cache and branch predictor, and how fetch picks among them
+thread_local uint64_t smt_threads = 1;
+thread_local FetchPolicy fetch_policy = FETCH_ICOUNT;
+
+// cycle each SMT thread's last instruction left the window in, 0 until
+// then, and the instructions each has retired
+thread_local uint64_t smt_drain_cycle[SMT_MAX_THREADS];
+thread_local unsigned long smt_retired[SMT_MAX_THREADS];
+
+// state each SMT thread keeps to itself, the running thread's is in the
+// globals above and its own slot is left empty until another thread runs
+typedef struct _smt_thread_t
+{
+    deque<proc_inst_t*> instructions;
+    uint64_t instructions_base = 1;
+    reg_t* reg = nullptr;
+    vector<checkpoint_t> checkpoints;
+    unsigned long ckpt_head = 0;
+    unsigned long ckpt_count = 0;
+    uint64_t ckpt_barrier = 0;
+    uint64_t dispatch_tag = 0;
+    deque<journal_entry_t> journal;
+    uint64_t journal_base = 0;
+    vector<uint64_t> journal_epoch;
+    list<proc_inst_t*> rob;
+    vector<uint32_t> arch_preg;
+    list<proc_inst_t*> dq;
+    unsigned long dq_size = 0;
+    unsigned long inst_tag_counter = 1;
+    unsigned long trailing_inst_tag = 1;
+    unsigned long fetch_ready = 0;
+    bool fetch_waiting = false;
+    proc_inst_t fetch_held;
+    bool fetch_holding = false;
+    bool fetch_exhausted = false;
+    proc_inst_t* fetch_blocker = nullptr;
+    uint64_t icache_last_line = UINT64_MAX;
+    uint64_t icache_fill_line = UINT64_MAX;
+
+} smt_thread_t;
+
+thread_local vector<smt_thread_t> smt_parked;
+thread_local unsigned int smt_current = 0;
+
+// thread fetch looks at first, so ties rotate
+thread_local unsigned int smt_fetch_next;
 
 // function pointers
 const FP stage_0[3] = {&cycle_stage_0, &cycle_stage_0_rob, &cycle_stage_0_cpr};
@@ -80,387 +267,545 @@ const FP stage_3[3] = {&cycle_stage_3, &cycle_stage_3_rob, &cycle_stage_3_cpr};
 const FP stage_4[3] = {&cycle_stage_4, &cycle_stage_4_rob, &cycle_stage_4_cpr};
 const FP stage_5[3] = {&cycle_stage_5, &cycle_stage_5_rob, &cycle_stage_5_cpr};
 const FP stage_6[3] = {&cycle_stage_6, &cycle_stage_6_rob, &cycle_stage_6_cpr};
+const FP* const stages[7] = {stage_0, stage_1, stage_2, stage_3, stage_4, stage_5, stage_6};
 
-//====================//
-//====================//
-//      TOMASULO      //
-//====================//
-//====================//
+// barrier of a multicore run, met every sync_quantum cycles
+thread_local FP sync_hook = nullptr;
+thread_local uint64_t sync_quantum = 0;
+thread_local uint64_t sync_countdown;
 
-// mark completed intstructions as retired
-void cycle_stage_0()
+// simulator self-profiling, of the whole run and of each stage
+thread_local bool profiling = false;
+thread_local bool stage_profiling = false;
+thread_local uint64_t stage_ticks[7];
+thread_local chrono::steady_clock::time_point run_start;
+
+// word-wise FNV-1a
+static inline uint64_t digest(uint64_t hash, uint64_t value)
 {
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+    return (hash ^ value) * 0x100000001b3ULL;
+}
 
-        proc_inst_t* inst = *iterator;
-        if (inst->state == State::COMPLETED) {
-            inst->state = State::RETIRED;
+// fold the timing of a retiring instruction into the digest
+static inline void digest_retire(proc_inst_t* inst)
+{
+    uint64_t hash = timing_digest;
 
-            //char log_line[80];
-            //sprintf(log_line, "%lu\tSTATE UPDATE\t%u\n", cycle_counter, inst->inst_tag);
-            //log_file << log_line;
+    hash = digest(hash, inst->inst_tag);
+    hash = digest(hash, inst->fetch);
+    hash = digest(hash, inst->disp);
+    hash = digest(hash, inst->sched);
+    hash = digest(hash, inst->exec);
+    hash = digest(hash, inst->update);
 
-            inst->update = cycle_counter;
-        }
-    }
+    timing_digest = hash;
 }
 
-// broadcast results on result buses
-// mark instructions as completed
-// update register files
-void cycle_stage_1()
+// looks up the line of an instruction, on a miss the line is filled and
+// fetch stalls for the miss latency
+static inline bool icache_access(uint32_t address)
 {
-    sb.sort([](proc_inst_t* x, proc_inst_t* y) {
-        if (x->fired_cycle < y->fired_cycle) {
-            return true;
-        } else if (x->fired_cycle > y->fired_cycle) {
-            return false;
-        } else {
-            return x->inst_tag < y->inst_tag;
-        }
-    });
+    uint64_t line = address >> icache_line_bits;
 
-    unsigned long buses_used = 0;
+    // sequential fetch mostly stays in the last line
+    if (line == icache_last_line) {
+        return true;
+    }
 
-    // if all cdbs are used
-    // or there are no instructions waiting to be broadcast
-    // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end();) {
+    // the retry once a missing line arrives is another lookup, it takes the
+    // line from the fill since another SMT thread may have evicted it since
+    icache_access_counter++;
 
-        proc_inst_t* inst = *iterator;
+    if (fetch_waiting && line == icache_fill_line) {
+        icache_last_line = line;
+        fetch_waiting = false;
+        return true;
+    }
 
-        // there is a free bus
-        if (buses_used < r) {
-            // put results on bus and free FU
-            cdb[buses_used] = inst;
-            buses_used++;
-            fu_busy_counter[inst->fu]--;
+    icache_clock++;
 
-            if (inst->state != State::EXECUTED) {
-                inst->state = State::EXECUTED;
+    uint64_t* tags = &icache_tags[(line & (icache_sets - 1)) * icache_assoc];
+    uint64_t* used = &icache_used[(line & (icache_sets - 1)) * icache_assoc];
+    uint64_t victim = 0;
 
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
-            }
+    for (uint64_t w = 0; w < icache_assoc; ++w) {
 
-            iterator = sb.erase(iterator);
+        if (tags[w] == line) {
+            used[w] = icache_clock;
+            icache_last_line = line;
+            fetch_waiting = false;
+            return true;
+        }
 
-        } else if (inst->state != State::EXECUTED) {
+        if (used[w] < used[victim]) {
+            victim = w;
+        }
+    }
 
-            inst->state = State::EXECUTED;
-            
-            //char log_line[80];
-            //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
-            //log_file << log_line;
+    tags[victim] = line;
+    used[victim] = icache_clock;
+    icache_last_line = UINT64_MAX;
+    icache_fill_line = line;
+    icache_miss_counter++;
 
-            ++iterator;
+    fetch_ready = cycle_counter + icache_latency;
+    fetch_waiting = true;
+    return false;
+}
 
-        } else {
+// reads the next trace instruction unless the instruction budget is spent
+static inline bool next_instruction(proc_inst_t* inst)
+{
+    if (inst_tag_counter <= inst_budget && read_instruction(inst)) {
+        return true;
+    }
 
-            ++iterator;
+    fetch_exhausted = true;
+    return false;
+}
+
+// reads the next trace instruction unless the instruction budget is spent
+// or its I-cache line is missing
+static bool fetch_instruction(proc_inst_t* inst)
+{
+    if (icache_sets == 0) {
+        return next_instruction(inst);
+    }
+
+    if (!fetch_holding) {
+
+        if (!next_instruction(&fetch_held)) {
+            return false;
         }
+
+        fetch_holding = true;
     }
 
-    // set tags of unused buses to infinity to prevent them from updating things
-    for (unsigned long i = buses_used; i < r; ++i) {
-        cdb[i] = dummy_inst;
+    if (!icache_access(fetch_held.instruction_address)) {
+        return false;
     }
 
-    // mark instruction as completed in scheduling queue
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+    *inst = fetch_held;
+    fetch_holding = false;
+    return true;
+}
 
-        proc_inst_t* inst = *iterator;
+// an instruction to fetch into, reusing a released one when there is one
+static inline proc_inst_t* new_instruction()
+{
+    if (inst_pool.empty()) {
+        return new proc_inst_t;
+    }
 
-        // check each result bus
-        for (unsigned long j = 0; j < r; ++j) {
-            if (inst->state == State::EXECUTED
-                && inst->inst_tag == cdb[j]->inst_tag) {
+    proc_inst_t* inst = inst_pool.back();
+    inst_pool.pop_back();
+    *inst = proc_inst_t();
+    return inst;
+}
 
-                inst->state = State::COMPLETED;
-                break;
-            }
-        }
-    }
+// releases the running thread's oldest instructions up to inst_tag once they
+// retired and left the window, nothing refetches or points at them again
+static inline void release_instructions(uint64_t inst_tag)
+{
+    while (!instructions.empty() && instructions_base <= inst_tag) {
 
-    // update register file
-    for (unsigned long j = 0; j < r; ++j) {
-        for (int i = 0; i < 128; ++i) {
+        proc_inst_t* inst = instructions.front();
 
-            if (reg[i].tag == cdb[j]->dest_tag) {
-                reg[i].ready = true;
-                break;
-            }
+        if (inst->state != State::RETIRED || inst == fetch_blocker) {
+            return;
         }
+
+        inst_pool.push_back(inst);
+        instructions.pop_front();
+        instructions_base++;
     }
 }
 
-// fire instructions in the scheduling queue
-void cycle_stage_2()
+// records a newly fetched instruction on the consumer chains of its producers
+static inline void link_producers(proc_inst_t* inst)
 {
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+    for (int i = 0; i < 2; ++i) {
 
-        proc_inst_t* inst = *iterator;
+        uint64_t tag = inst->producer[i];
 
-        if (inst->src_ready[0]
-            && inst->src_ready[1]
-            && fu_busy_counter[inst->fu] < k[inst->fu]
-            && inst->state == State::DISPATCHED) {
+        // a producer feeding both sources is chained through slot 0 only,
+        // none is tag 0, and a released one never broadcasts again
+        if (tag < instructions_base || (i == 1 && tag == inst->producer[0])) {
+            continue;
+        }
 
-            inst->state = State::FIRED;
-            inst->fired_cycle = cycle_counter;
-            fired_counter++;
-            sb.push_back(inst);
-            fu_busy_counter[inst->fu]++;
+        proc_inst_t* producer = instructions[tag - instructions_base];
+        inst->next_consumer[i] = producer->consumers;
+        producer->consumers = inst;
+    }
+}
 
-            //char log_line[80];
-            //sprintf(log_line, "%lu\tSCHEDULED\t%u\n", cycle_counter, inst->inst_tag);
-            //log_file << log_line;
+// marks the sources waiting on a broadcast result as ready
+// only the producer's consumers can hold its tag, so the scheduling queue is not scanned
+static inline void wake_consumers(const proc_inst_t* producer)
+{
+    for (proc_inst_t* inst = producer->consumers; inst != nullptr;) {
 
-            inst->exec = cycle_counter + 1;
+        if (inst->state == State::DISPATCHED) {
+            for (int i = 0; i < 2; ++i) {
+                if (inst->src_tag[i] == producer->dest_tag) {
+                    inst->src_ready[i] = true;
+                }
+            }
         }
+
+        inst = inst->next_consumer[inst->producer[0] == producer->inst_tag ? 0 : 1];
     }
 }
 
-// update scheduling queue via result buses
-void cycle_stage_3()
+// marks the registers the results on the buses are named for as ready
+// only a register waiting on a result can hold its tag, since tags wrap
+static inline void update_reg_file()
 {
-    // for each result bus
     for (unsigned long j = 0; j < r; ++j) {
-        // for each instruction
-        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
-            // for each source register
-            for (unsigned long k = 0; k < 2; ++k) {
 
-                proc_inst_t* inst = *iterator;
+        if (cdb[j]->dest_reg < 0) {
+            continue;
+        }
 
-                if (inst->state == State::DISPATCHED
-                    && cdb[j]->dest_tag == inst->src_tag[k]) {
+        for (int i = 0; i < 128; ++i) {
 
-                    inst->src_ready[k] = true;
-                }
+            if (!reg[i].ready && reg[i].tag == cdb[j]->dest_tag) {
+                reg[i].ready = true;
+                break;
             }
         }
     }
 }
 
-// dispatch instructions to scheduling queue
-// dispatch queue reads register file
-void cycle_stage_4()
+// true if the instruction cannot rename its destination for lack of a
+// free physical register
+static inline bool prf_full(const proc_inst_t* inst)
 {
-    // if the scheduling queue is full
-    // or the dispatch queue is empty
-    // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end();) {
-
-        // scheduling queue is full
-        if (sq_size == sq_max_size) {
-            break;
-        }
-
-        proc_inst_t* inst = *iterator;
-        iterator = dq.erase(iterator);
-        dq_size--;
+    return prf_size != 0 && inst->dest_reg > -1 && preg_free.empty();
+}
 
-        //char log_line[80];
-        //sprintf(log_line, "%lu\tDISPATCHED\t%u\n", cycle_counter, inst->inst_tag);
-        //log_file << log_line;
+// maps the destination onto a free physical register
+static inline void rename_dest(proc_inst_t* inst)
+{
+    uint32_t preg = preg_free.back();
+    preg_free.pop_back();
+    preg_holds[preg] = 2;
 
-        inst->sched = cycle_counter + 1;
+    inst->preg = preg;
+    inst->prev_preg = reg[inst->dest_reg].preg;
+    reg[inst->dest_reg].preg = preg;
+}
 
-        inst->state = State::DISPATCHED;
+static inline void release_preg(uint32_t preg)
+{
+    if (preg_holds[preg] > 0 && --preg_holds[preg] == 0) {
+        preg_free.push_back(preg);
+    }
+}
 
-        for (int i = 0; i < 2; ++i) {
+// a retiring writer's register becomes architectural, and the register it
+// replaced is freed once its own producer has retired too
+static inline void retire_dest(const proc_inst_t* inst)
+{
+    if (prf_size == 0 || inst->dest_reg < 0) {
+        return;
+    }
 
-            if (inst->src_reg[i] == -1) {
+    arch_preg[inst->dest_reg] = inst->preg;
+    release_preg(inst->preg);
+    release_preg(inst->prev_preg);
+}
 
-                inst->src_ready[i] = true;
+// after a flush only the registers of the maps and of the instructions
+// left in the scheduling queue are live
+static void reset_prf()
+{
+    if (prf_size == 0) {
+        return;
+    }
 
-            } else if (reg[inst->src_reg[i]].ready) {
+    preg_holds.assign(prf_size, 0);
+    preg_free.clear();
 
-                inst->src_ready[i] = true;
-                reg_hit_counter++;
+    for (int i = 0; i < 128; ++i) {
+        preg_holds[reg[i].preg]++;
+    }
 
-            } else {
+    // so are those a CPR rollback may restore
+    for (size_t i = 0; i < journal.size(); ++i) {
+        preg_holds[journal[i].old.preg]++;
+    }
 
-                inst->src_tag[i] = reg[inst->src_reg[i]].tag;
-                inst->src_ready[i] = false;
-                reg_hit_counter++;
+    // the other SMT threads share the register file
+    for (unsigned int t = 0; t < smt_threads; ++t) {
+        if (t != smt_current) {
+            for (int i = 0; i < 128; ++i) {
+                preg_holds[smt_parked[t].reg[i].preg]++;
+            }
+            for (size_t i = 0; i < smt_parked[t].journal.size(); ++i) {
+                preg_holds[smt_parked[t].journal[i].old.preg]++;
             }
         }
+    }
 
-        // assign new tag to destination register
-        if (inst->dest_reg > -1) {
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
 
-            reg[inst->dest_reg].tag = reg_tag_counter;
-            reg[inst->dest_reg].ready = false;
-            inst->dest_tag = reg_tag_counter;
-            reg_tag_counter++;
+        proc_inst_t* inst = *iterator;
+
+        if (inst->dest_reg > -1 && inst->state != State::RETIRED) {
+            preg_holds[inst->preg]++;
+            preg_holds[inst->prev_preg]++;
         }
+    }
 
-        sq.push_back(inst);
-        sq_size++;
+    for (uint64_t i = prf_size; i-- > 0;) {
+        if (preg_holds[i] == 0) {
+            preg_free.push_back(i);
+        }
     }
+}
 
-    // scheduling queue reads register file
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+// result bus arbitration order, exec is stamped when an instruction fires
+// so this is oldest fired first
+static inline bool fired_before(const proc_inst_t* x, const proc_inst_t* y)
+{
+    if (x->exec != y->exec) {
+        return x->exec < y->exec;
+    }
 
-        proc_inst_t* inst = *iterator;
+    if (x->inst_tag != y->inst_tag) {
+        return x->inst_tag < y->inst_tag;
+    }
 
-        if (inst->state == State::DISPATCHED) {
-            // set instruction ready bits
-            for (int i = 0; i < 2; ++i) {
+    return x->thread < y->thread;
+}
 
-                if (inst->src_ready[i] == false) {
-                    if (reg[inst->src_reg[i]].tag == inst->src_tag[i] && reg[inst->src_reg[i]].ready) {
+// starts executing a fired instruction on its FU
+static inline void start_execution(proc_inst_t* inst)
+{
+    completions[(cycle_counter + fu_latency[inst->fu]) & wheel_mask].push_back(inst);
+    executing++;
+    fu_busy_counter[inst->fu]++;
 
-                        inst->src_ready[i] = true;
-                    }
-                }
-            }
-        }
+    if (fu_pipelined[inst->fu]) {
+        fu_issued[inst->fu]++;
     }
 }
 
-// deletes retired instructions from the scheduling queue
-void cycle_stage_5()
+// merges the instructions finishing this cycle into the scoreboard in bus order
+// only the finishing instructions are touched, so the cost does not grow with latency
+static inline void finish_execution()
 {
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end();) {
+    // a pipelined FU takes new work once the last one moved down the pipe
+    for (int i = 0; i < 3; ++i) {
+        if (fu_pipelined[i]) {
+            fu_busy_counter[i] -= fu_issued[i];
+            fu_issued[i] = 0;
+        }
+    }
 
-        proc_inst_t* inst = *iterator;
+    finished.clear();
+    finished.swap(completions[cycle_counter & wheel_mask]);
+    executing -= finished.size();
 
-        if (inst->state == State::RETIRED) {
-            iterator = sq.erase(iterator);
-            retired_counter++;
-            sq_size--;
-        } else {
+    sort(finished.begin(), finished.end(), fired_before);
+
+    list<proc_inst_t*>::iterator iterator = sb.begin();
+    for (size_t i = 0; i < finished.size(); ++i) {
+        while (iterator != sb.end() && fired_before(*iterator, finished[i])) {
             ++iterator;
         }
+        sb.insert(iterator, finished[i]);
     }
 }
 
-// fetch instructions
-// update cycle counter
-void cycle_stage_6()
+// finished instructions that lost bus arbitration this cycle wait in the scoreboard
+static inline void hold_finished()
 {
-    for (unsigned long i = 0; i < f; ++i) {
+    for (size_t i = 0; i < finished.size(); ++i) {
 
-        proc_inst_t* inst = new proc_inst_t;
-        bool success = read_instruction(inst);
+        proc_inst_t* inst = finished[i];
 
-        if (success) {
+        if (inst->state == State::FIRED) {
 
-            // initialize instruction
-            inst->fu = abs(inst->op_code);
-            inst->inst_tag = inst_tag_counter++;
-            inst->dest_tag = UINT32_MAX;
-            inst->src_ready[0] = false;
-            inst->src_ready[1] = false;
-            inst->state = State::FETCHED;
+            inst->state = State::EXECUTED;
+
+            if (fu_pipelined[inst->fu]) {
+                fu_busy_counter[inst->fu]++;
+            }
 
             //char log_line[80];
-            //sprintf(log_line, "%lu\tFETCHED\t%u\n", cycle_counter, inst->inst_tag);
+            //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
             //log_file << log_line;
+        }
+    }
+}
 
-            inst->fetch = cycle_counter;
-            inst->disp = cycle_counter + 1;
+// drops the executing instructions of the running thread younger than
+// inst_tag after a flush, handing back the FUs they hold
+static void flush_execution_after(uint64_t inst_tag)
+{
+    // results waiting for a bus hold their FU, pipelined or not
+    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end();) {
+        if ((*iterator)->thread == smt_current && (*iterator)->inst_tag > inst_tag) {
+            fu_busy_counter[(*iterator)->fu]--;
+            iterator = sb.erase(iterator);
+        } else {
+            ++iterator;
+        }
+    }
 
-            instructions.push_back(inst);
+    // a pipelined FU is only held by an instruction issued last cycle
+    for (size_t i = 0; i < completions.size(); ++i) {
 
-            // insert instruction into dispatch queue
-            dq.push_back(inst);
-            dq_size++;
+        vector<proc_inst_t*>& slot = completions[i];
+        size_t kept = 0;
 
-            // update max size
-            if (dq_size > dq_max_size) {
-                dq_max_size = dq_size;
+        for (size_t j = 0; j < slot.size(); ++j) {
+
+            proc_inst_t* inst = slot[j];
+
+            if (inst->thread != smt_current || inst->inst_tag <= inst_tag) {
+                slot[kept++] = inst;
+                continue;
+            }
+
+            executing--;
+
+            if (!fu_pipelined[inst->fu]) {
+                fu_busy_counter[inst->fu]--;
+            } else if (inst->exec == cycle_counter) {
+                fu_issued[inst->fu]--;
+                fu_busy_counter[inst->fu]--;
             }
         }
+
+        slot.resize(kept);
     }
 
-    dq_size_sum += dq_size;
-    cycle_counter++;
+    finished.clear();
 }
 
-//=====================//
-//=====================//
-//   RE-ORDER BUFFER   //
-//=====================//
-//=====================//
-
-// mark completed intstructions as retired
-void cycle_stage_0_rob()
+// drops every executing instruction after a flush
+static inline void flush_execution()
 {
-    unsigned long retired = 0;
-
-    for (list<proc_inst_t*>::iterator iterator = rob.begin(); iterator != rob.end(); ++iterator) {
+    sb.clear();
+    finished.clear();
+    executing = 0;
 
-        proc_inst_t* inst = *iterator;
-
-        if (inst->state == State::COMPLETED) {
+    for (size_t i = 0; i < completions.size(); ++i) {
+        completions[i].clear();
+    }
 
-            if (inst->exception) {
+    for (int i = 0; i < 3; ++i) {
+        fu_issued[i] = 0;
+        fu_busy_counter[i] = 0;
+    }
+}
 
-                inst->exception = false;
+// removes the running thread's instructions younger than inst_tag from the
+// scheduling queue, returning how many of them had not retired
+static unsigned long flush_window_after(uint64_t inst_tag)
+{
+    unsigned long flushed = 0;
 
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tEXCEPTION\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end();) {
 
-                // handle exception
-                exception_counter++;
-                flushed_counter += (sq_size - retired);
+        proc_inst_t* inst = *iterator;
 
-                rob.clear();
-                dq.clear();
-                sq.clear();
-                sb.clear();
+        if (inst->thread == smt_current && inst->inst_tag > inst_tag) {
+            flushed += inst->state != State::RETIRED;
+            iterator = sq.erase(iterator);
+            sq_size--;
+        } else {
+            ++iterator;
+        }
+    }
 
-                dq_size = 0;
-                sq_size = 0;
+    return flushed;
+}
 
-                for (int i = 0; i < 3; ++i) {
-                    fu_busy_counter[i] = 0;
-                }
+// the running thread's youngest instruction in the scheduling queue,
+// which must hold one
+static inline proc_inst_t* youngest_dispatched()
+{
+    list<proc_inst_t*>::reverse_iterator iterator = sq.rbegin();
 
-                for (unsigned long i = 0; i < r; ++i) {
-                    cdb[i] = dummy_inst;
-                }
+    while ((*iterator)->thread != smt_current) {
+        ++iterator;
+    }
 
-                for (int i = 0; i < 128; ++i) {
-                    reg[i].tag = reg_tag_counter++;
-                    reg[i].ready = true;
-                }
+    return *iterator;
+}
 
-                trailing_inst_tag = inst->inst_tag;
-                unsigned long i = 1;
-                for (list<proc_inst_t*>::iterator iterator = instructions.begin(); iterator != instructions.end(); ++iterator) {
-                    if (i == trailing_inst_tag) {
-                        trailing_ptr = iterator;
-                        break;
-                    }
-                    i++;
-                }
+// trades the per-thread globals for a parked SMT thread
+static void exchange_thread(smt_thread_t& t)
+{
+    swap(instructions, t.instructions);
+    swap(instructions_base, t.instructions_base);
+    swap(reg, t.reg);
+    swap(checkpoints, t.checkpoints);
+    swap(ckpt_head, t.ckpt_head);
+    swap(ckpt_count, t.ckpt_count);
+    swap(ckpt_barrier, t.ckpt_barrier);
+    swap(dispatch_tag, t.dispatch_tag);
+    swap(journal, t.journal);
+    swap(journal_base, t.journal_base);
+    swap(journal_epoch, t.journal_epoch);
+    swap(rob, t.rob);
+    swap(arch_preg, t.arch_preg);
+    swap(dq, t.dq);
+    swap(dq_size, t.dq_size);
+    swap(inst_tag_counter, t.inst_tag_counter);
+    swap(trailing_inst_tag, t.trailing_inst_tag);
+    swap(fetch_ready, t.fetch_ready);
+    swap(fetch_waiting, t.fetch_waiting);
+    swap(fetch_held, t.fetch_held);
+    swap(fetch_holding, t.fetch_holding);
+    swap(fetch_exhausted, t.fetch_exhausted);
+    swap(fetch_blocker, t.fetch_blocker);
+    swap(icache_last_line, t.icache_last_line);
+    swap(icache_fill_line, t.icache_fill_line);
+}
 
-                cycle_counter++;
-                break;
+// parks the running SMT thread in its slot and runs another, whose slot is
+// left empty
+static void switch_thread(unsigned int thread)
+{
+    if (thread == smt_current) {
+        return;
+    }
 
-            } else {
+    exchange_thread(smt_parked[smt_current]);
+    exchange_thread(smt_parked[thread]);
+    smt_current = thread;
+    select_trace(thread);
+}
 
-                inst->state = State::RETIRED;
-                retired_counter++;
-                retired++;
+//====================//
+//====================//
+//      TOMASULO      //
+//====================//
+//====================//
 
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tSTATE UPDATE\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
+// mark completed intstructions as retired
+void cycle_stage_0()
+{
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
 
-                inst->update = cycle_counter;
-            }
+        proc_inst_t* inst = *iterator;
+        if (inst->state == State::COMPLETED && inst->thread == smt_current) {
+            inst->state = State::RETIRED;
+            retired_this_cycle++;
+            retire_dest(inst);
 
-        } else {
+            //char log_line[80];
+            //sprintf(log_line, "%lu\tSTATE UPDATE\t%u\n", cycle_counter, inst->inst_tag);
+            //log_file << log_line;
 
-            break;
+            inst->update = cycle_counter;
+            digest_retire(inst);
         }
     }
 }
@@ -468,64 +813,40 @@ void cycle_stage_0_rob()
 // broadcast results on result buses
 // mark instructions as completed
 // update register files
-void cycle_stage_1_rob()
+void cycle_stage_1()
 {
-    sb.sort([](proc_inst_t* x, proc_inst_t* y) {
-        if (x->fired_cycle < y->fired_cycle) {
-            return true;
-        } else if (x->fired_cycle > y->fired_cycle) {
-            return false;
-        } else {
-            return x->inst_tag < y->inst_tag;
-        }
-    });
+    finish_execution();
 
     unsigned long buses_used = 0;
 
     // if all cdbs are used
     // or there are no instructions waiting to be broadcast
     // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end();) {
+    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end() && buses_used < r;) {
 
         proc_inst_t* inst = *iterator;
 
-        // there is a free bus
-        if (buses_used < r) {
-            // put results on bus and free FU
-            cdb[buses_used] = inst;
-            buses_used++;
+        // put results on bus and free FU
+        // a pipelined FU is only held by a result stuck waiting for a bus
+        cdb[buses_used] = inst;
+        buses_used++;
+        if (!fu_pipelined[inst->fu] || inst->state == State::EXECUTED) {
             fu_busy_counter[inst->fu]--;
+        }
 
-            if (inst->state != State::EXECUTED) {
-                inst->state = State::EXECUTED;
-
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
-            }
-
-            //char log_line[80];
-            //sprintf(log_line, "%lu\tBROADCASTED\t%u\n", cycle_counter, inst->inst_tag);
-            //log_file << log_line;
-
-            iterator = sb.erase(iterator);
-
-        } else if (inst->state == State::FIRED) {
-
+        if (inst->state != State::EXECUTED) {
             inst->state = State::EXECUTED;
-            
+
             //char log_line[80];
             //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
             //log_file << log_line;
-
-            ++iterator;
-
-        } else {
-
-            ++iterator;
         }
+
+        iterator = sb.erase(iterator);
     }
 
+    hold_finished();
+
     // set tags of unused buses to infinity to prevent them from updating things
     for (unsigned long i = buses_used; i < r; ++i) {
         cdb[i] = dummy_inst;
@@ -538,8 +859,7 @@ void cycle_stage_1_rob()
 
         // check each result bus
         for (unsigned long j = 0; j < r; ++j) {
-            if (inst->state == State::EXECUTED
-                && inst->inst_tag == cdb[j]->inst_tag) {
+            if (inst->state == State::EXECUTED && inst == cdb[j]) {
 
                 inst->state = State::COMPLETED;
                 break;
@@ -548,19 +868,11 @@ void cycle_stage_1_rob()
     }
 
     // update register file
-    for (unsigned long j = 0; j < r; ++j) {
-        for (int i = 0; i < 128; ++i) {
-
-            if (reg[i].tag == cdb[j]->dest_tag) {
-                reg[i].ready = true;
-                break;
-            }
-        }
-    }
+    update_reg_file();
 }
 
 // fire instructions in the scheduling queue
-void cycle_stage_2_rob()
+void cycle_stage_2()
 {
     for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
 
@@ -572,10 +884,8 @@ void cycle_stage_2_rob()
             && inst->state == State::DISPATCHED) {
 
             inst->state = State::FIRED;
-            inst->fired_cycle = cycle_counter;
             fired_counter++;
-            sb.push_back(inst);
-            fu_busy_counter[inst->fu]++;
+            start_execution(inst);
 
             //char log_line[80];
             //sprintf(log_line, "%lu\tSCHEDULED\t%u\n", cycle_counter, inst->inst_tag);
@@ -587,45 +897,35 @@ void cycle_stage_2_rob()
 }
 
 // update scheduling queue via result buses
-void cycle_stage_3_rob()
+void cycle_stage_3()
 {
     // for each result bus
     for (unsigned long j = 0; j < r; ++j) {
-        // for each instruction
-        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
-            // for each source register
-            for (unsigned long k = 0; k < 2; ++k) {
-
-                proc_inst_t* inst = *iterator;
-
-                if (inst->state == State::DISPATCHED
-                    && cdb[j]->dest_tag == inst->src_tag[k]) {
-
-                    inst->src_ready[k] = true;
-                }
-            }
-        }
+        wake_consumers(cdb[j]);
     }
 }
 
 // dispatch instructions to scheduling queue
-// scheduling queue reads register file
-void cycle_stage_4_rob()
+// dispatch queue reads register file
+void cycle_stage_4()
 {
-    // update max size
-    if (dq_size > dq_max_size) {
-        dq_max_size = dq_size;
-    }
-
-    dq_size_sum += dq_size;
+    unsigned long dispatched = 0;
 
     // if the scheduling queue is full
     // or the dispatch queue is empty
+    // or the dispatch width is used up
     // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end();) {
+    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end() && dispatched < dispatch_width;) {
 
         // scheduling queue is full
         if (sq_size == sq_max_size) {
+            sq_full_stall = true;
+            break;
+        }
+
+        // so is the register file, counted as a full window
+        if (prf_full(*iterator)) {
+            sq_full_stall = true;
             break;
         }
 
@@ -641,32 +941,6 @@ void cycle_stage_4_rob()
 
         inst->state = State::DISPATCHED;
 
-        for (int i = 0; i < 2; ++i) {
-
-            if (inst->src_reg[i] != -1) {
-
-                // check ROB
-                bool found = false;
-                for (list<proc_inst_t*>::reverse_iterator iterator = rob.rbegin(); iterator != rob.rend(); ++iterator) {
-
-                    proc_inst_t* rob_inst = *iterator;
-
-                    if (rob_inst->dest_reg == inst->src_reg[i]) {
-
-                        found = true;
-                        break;
-                    }
-                }
-
-                // check register file
-                if (found) {
-                    rob_hit_counter++;
-                } else {
-                    reg_hit_counter++;
-                }
-            }
-        }
-
         for (int i = 0; i < 2; ++i) {
 
             if (inst->src_reg[i] == -1) {
@@ -676,17 +950,23 @@ void cycle_stage_4_rob()
             } else if (reg[inst->src_reg[i]].ready) {
 
                 inst->src_ready[i] = true;
+                reg_hit_counter++;
 
             } else {
 
                 inst->src_tag[i] = reg[inst->src_reg[i]].tag;
                 inst->src_ready[i] = false;
+                reg_hit_counter++;
             }
         }
 
         // assign new tag to destination register
         if (inst->dest_reg > -1) {
 
+            if (prf_size != 0) {
+                rename_dest(inst);
+            }
+
             reg[inst->dest_reg].tag = reg_tag_counter;
             reg[inst->dest_reg].ready = false;
             inst->dest_tag = reg_tag_counter;
@@ -695,11 +975,7 @@ void cycle_stage_4_rob()
 
         sq.push_back(inst);
         sq_size++;
-
-        rob.push_back(inst);
-        rob.sort([](proc_inst_t* x, proc_inst_t* y) {
-            return x->inst_tag < y->inst_tag;
-        });
+        dispatched++;
     }
 
     // scheduling queue reads register file
@@ -723,7 +999,7 @@ void cycle_stage_4_rob()
 }
 
 // deletes retired instructions from the scheduling queue
-void cycle_stage_5_rob()
+void cycle_stage_5()
 {
     for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end();) {
 
@@ -731,156 +1007,155 @@ void cycle_stage_5_rob()
 
         if (inst->state == State::RETIRED) {
             iterator = sq.erase(iterator);
+            retired_counter++;
+            smt_retired[inst->thread]++;
             sq_size--;
         } else {
             ++iterator;
         }
     }
 
-    for (list<proc_inst_t*>::iterator iterator = rob.begin(); iterator != rob.end();) {
-
-        proc_inst_t* inst = *iterator;
-
-        if (inst->state == State::RETIRED) {
-            iterator = rob.erase(iterator);
-        } else {
-            ++iterator;
-        }
-    }
+    release_instructions(UINT64_MAX);
 }
 
 // fetch instructions
-// update cycle counter
-void cycle_stage_6_rob()
+void cycle_stage_6()
 {
     for (unsigned long i = 0; i < f; ++i) {
 
-        bool trailing = trailing_inst_tag < inst_tag_counter;
-        proc_inst_t* inst;
-        bool success;
-
-        if (trailing) {
-
-            inst = *trailing_ptr;
-            success = true;
+        // an I-cache miss stalls fetch until the line arrives
+        if (cycle_counter < fetch_ready) {
+            break;
+        }
 
-        } else {
+        // a full dispatch queue holds fetch back
+        if (dq_size >= dq_capacity) {
+            break;
+        }
 
-            inst = new proc_inst_t;
-            success = read_instruction(inst);
+        // so does a mispredicted branch until it executes
+        if (fetch_blocker != nullptr) {
+            if (fetch_blocker->state < State::EXECUTED) {
+                break;
+            }
+            fetch_blocker = nullptr;
         }
 
+        proc_inst_t* inst = new_instruction();
+        bool success = fetch_instruction(inst);
+
         if (success) {
 
             // initialize instruction
+            inst->fu = abs(inst->op_code);
+            inst->thread = smt_current;
+            inst->inst_tag = inst_tag_counter++;
+            link_producers(inst);
             inst->dest_tag = UINT32_MAX;
             inst->src_ready[0] = false;
             inst->src_ready[1] = false;
             inst->state = State::FETCHED;
 
-            if (trailing) {
-
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tRE-FETCHED\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
-
-            } else {
-
-                inst->fu = abs(inst->op_code);
-                inst->exception = !(inst_tag_counter % e);
-                inst->inst_tag = inst_tag_counter++;
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tFETCHED\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
-            }
-
-            trailing_inst_tag++;
+            //char log_line[80];
+            //sprintf(log_line, "%lu\tFETCHED\t%u\n", cycle_counter, inst->inst_tag);
+            //log_file << log_line;
 
             inst->fetch = cycle_counter;
             inst->disp = cycle_counter + 1;
 
-            if (instructions.empty()) {
-                instructions.push_back(inst);
-                trailing_ptr = instructions.begin();
-            } else if (!trailing) {
-                instructions.push_back(inst);
-                trailing_ptr++;
-            } else {
-                trailing_ptr++;
-            }
+            instructions.push_back(inst);
 
             // insert instruction into dispatch queue
             dq.push_back(inst);
             dq_size++;
 
             // update max size
-            //if (dq_size > dq_max_size) {
-            //    dq_max_size = dq_size;
-            //}
-        }
-    }
+            if (dq_size > dq_max_size) {
+                dq_max_size = dq_size;
+            }
 
-    //dq_size_sum += dq_size;
-    cycle_counter++;
-}
+            if (bpred_kind != BPRED_PERFECT && !bpred_predict(inst->instruction_address, inst->taken)) {
+                fetch_blocker = inst;
+                break;
+            }
+
+        } else {
+
+            inst_pool.push_back(inst);
+        }
+    }
+
+    dq_size_sum += dq_size;
+}
 
 //=====================//
 //=====================//
-//  CHECKPOINT REPAIR  //
+//   RE-ORDER BUFFER   //
 //=====================//
 //=====================//
 
 // mark completed intstructions as retired
-void cycle_stage_0_cpr()
+void cycle_stage_0_rob()
 {
-    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+    for (list<proc_inst_t*>::iterator iterator = rob.begin(); iterator != rob.end(); ++iterator) {
 
         proc_inst_t* inst = *iterator;
 
         if (inst->state == State::COMPLETED) {
 
-            if (inst->exception) {
+            if (inst->exception || inst->mispredict) {
 
-                inst->exception = false;
+                // an excepting instruction is refetched, a mispredicted
+                // branch retires and everything after it is refetched
+                if (inst->exception) {
 
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tEXCEPTION\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
+                    inst->exception = false;
+
+                    //char log_line[80];
+                    //sprintf(log_line, "%lu\tEXCEPTION\t%u\n", cycle_counter, inst->inst_tag);
+                    //log_file << log_line;
+
+                    exception_counter++;
+                    trailing_inst_tag = inst->inst_tag;
+
+                } else {
+
+                    inst->mispredict = false;
+                    inst->state = State::RETIRED;
+                    retired_this_cycle++;
+                    retired_counter++;
+                    smt_retired[inst->thread]++;
+                    retire_dest(inst);
+
+                    inst->update = cycle_counter;
+                    digest_retire(inst);
+
+                    trailing_inst_tag = inst->inst_tag + 1;
+                }
 
                 // handle exception
-                exception_counter++;
-                flushed_counter += sq.back()->inst_tag - ib2->inst_tag;
+                flushed_counter += flush_window_after(0);
 
+                rob.clear();
                 dq.clear();
-                sq.clear();
-                sb.clear();
+                flush_execution_after(0);
 
                 dq_size = 0;
-                sq_size = 0;
-
-                for (int i = 0; i < 3; ++i) {
-                    fu_busy_counter[i] = 0;
-                }
 
                 for (unsigned long i = 0; i < r; ++i) {
                     cdb[i] = dummy_inst;
                 }
 
                 for (int i = 0; i < 128; ++i) {
-                    reg[i].tag = backup_2[i].tag;
-                    backup_1[i].tag = backup_2[i].tag;
+                    reg[i].tag = reg_tag_counter++;
                     reg[i].ready = true;
+                    reg[i].preg = arch_preg[i];
                 }
+                reset_prf();
 
-                trailing_inst_tag = ib2->inst_tag + 1;
-                unsigned long i = 1;
-                for (list<proc_inst_t*>::iterator iterator = instructions.begin(); iterator != instructions.end(); ++iterator) {
-                    if (i == trailing_inst_tag) {
-                        trailing_ptr = iterator;
-                        break;
-                    }
-                    i++;
-                }
+                // the flush costs a cycle, then the window refills
+                stall_slots[STALL_REFILL] += f;
+                refilling = true;
 
                 cycle_counter++;
                 break;
@@ -888,45 +1163,22 @@ void cycle_stage_0_cpr()
             } else {
 
                 inst->state = State::RETIRED;
+                retired_this_cycle++;
+                retired_counter++;
+                smt_retired[inst->thread]++;
+                retire_dest(inst);
 
                 //char log_line[80];
                 //sprintf(log_line, "%lu\tSTATE UPDATE\t%u\n", cycle_counter, inst->inst_tag);
                 //log_file << log_line;
 
                 inst->update = cycle_counter;
+                digest_retire(inst);
             }
 
-            int count = 0;
-
-            for (list<proc_inst_t*>::iterator _iterator = sq.begin(); _iterator != sq.end(); ++_iterator) {
-
-                proc_inst_t* _inst = *_iterator;
-                uint32_t ib_inst_tag = (ib1 == nullptr ? 20 : ib1->inst_tag);
-
-                if (_inst->inst_tag <= ib_inst_tag &&
-                    _inst->state != State::RETIRED) {
-
-                    count++;
-                }
-            }
-
-            if (count == 0) {
-
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tBACKUP2\t%u\tTO\t%u\n", cycle_counter, ib2 == nullptr ? 1 : ib2->inst_tag + 1, ib1->inst_tag);
-                //log_file << log_line;
-
-                for (int i = 0; i < 128; ++i) {
-                    backup_2[i] = backup_1[i];
-                    backup_1[i] = reg[i];
-                }
-
-                retired_counter += (ib2 == nullptr ? 20 : ib1->inst_tag - ib2->inst_tag);
-                backup_counter++;
+        } else {
 
-                ib2 = ib1;
-                ib1 = sq.back();
-            }
+            break;
         }
     }
 }
@@ -934,64 +1186,44 @@ void cycle_stage_0_cpr()
 // broadcast results on result buses
 // mark instructions as completed
 // update register files
-void cycle_stage_1_cpr()
+void cycle_stage_1_rob()
 {
-    sb.sort([](proc_inst_t* x, proc_inst_t* y) {
-        if (x->fired_cycle < y->fired_cycle) {
-            return true;
-        } else if (x->fired_cycle > y->fired_cycle) {
-            return false;
-        } else {
-            return x->inst_tag < y->inst_tag;
-        }
-    });
+    finish_execution();
 
     unsigned long buses_used = 0;
 
     // if all cdbs are used
     // or there are no instructions waiting to be broadcast
     // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end();) {
+    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end() && buses_used < r;) {
 
         proc_inst_t* inst = *iterator;
 
-        // there is a free bus
-        if (buses_used < r) {
-            // put results on bus and free FU
-            cdb[buses_used] = inst;
-            buses_used++;
+        // put results on bus and free FU
+        // a pipelined FU is only held by a result stuck waiting for a bus
+        cdb[buses_used] = inst;
+        buses_used++;
+        if (!fu_pipelined[inst->fu] || inst->state == State::EXECUTED) {
             fu_busy_counter[inst->fu]--;
+        }
 
-            if (inst->state != State::EXECUTED) {
-                inst->state = State::EXECUTED;
-
-                //char log_line[80];
-                //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
-                //log_file << log_line;
-            }
-
-            //char log_line[80];
-            //sprintf(log_line, "%lu\tBROADCASTED\t%u\n", cycle_counter, inst->inst_tag);
-            //log_file << log_line;
-
-            iterator = sb.erase(iterator);
-
-        } else if (inst->state == State::FIRED) {
-
+        if (inst->state != State::EXECUTED) {
             inst->state = State::EXECUTED;
-            
+
             //char log_line[80];
             //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
             //log_file << log_line;
+        }
 
-            ++iterator;
-
-        } else {
+        //char log_line[80];
+        //sprintf(log_line, "%lu\tBROADCASTED\t%u\n", cycle_counter, inst->inst_tag);
+        //log_file << log_line;
 
-            ++iterator;
-        }
+        iterator = sb.erase(iterator);
     }
 
+    hold_finished();
+
     // set tags of unused buses to infinity to prevent them from updating things
     for (unsigned long i = buses_used; i < r; ++i) {
         cdb[i] = dummy_inst;
@@ -1004,8 +1236,7 @@ void cycle_stage_1_cpr()
 
         // check each result bus
         for (unsigned long j = 0; j < r; ++j) {
-            if (inst->state == State::EXECUTED
-                && inst->inst_tag == cdb[j]->inst_tag) {
+            if (inst->state == State::EXECUTED && inst == cdb[j]) {
 
                 inst->state = State::COMPLETED;
                 break;
@@ -1014,19 +1245,11 @@ void cycle_stage_1_cpr()
     }
 
     // update register file
-    for (unsigned long j = 0; j < r; ++j) {
-        for (int i = 0; i < 128; ++i) {
-
-            if (reg[i].tag == cdb[j]->dest_tag) {
-                reg[i].ready = true;
-                break;
-            }
-        }
-    }
+    update_reg_file();
 }
 
 // fire instructions in the scheduling queue
-void cycle_stage_2_cpr()
+void cycle_stage_2_rob()
 {
     for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
 
@@ -1038,10 +1261,8 @@ void cycle_stage_2_cpr()
             && inst->state == State::DISPATCHED) {
 
             inst->state = State::FIRED;
-            inst->fired_cycle = cycle_counter;
             fired_counter++;
-            sb.push_back(inst);
-            fu_busy_counter[inst->fu]++;
+            start_execution(inst);
 
             //char log_line[80];
             //sprintf(log_line, "%lu\tSCHEDULED\t%u\n", cycle_counter, inst->inst_tag);
@@ -1053,30 +1274,17 @@ void cycle_stage_2_cpr()
 }
 
 // update scheduling queue via result buses
-void cycle_stage_3_cpr()
+void cycle_stage_3_rob()
 {
     // for each result bus
     for (unsigned long j = 0; j < r; ++j) {
-        // for each instruction
-        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
-            // for each source register
-            for (unsigned long k = 0; k < 2; ++k) {
-
-                proc_inst_t* inst = *iterator;
-
-                if (inst->state == State::DISPATCHED
-                    && cdb[j]->dest_tag == inst->src_tag[k]) {
-
-                    inst->src_ready[k] = true;
-                }
-            }
-        }
+        wake_consumers(cdb[j]);
     }
 }
 
 // dispatch instructions to scheduling queue
-// dispatch queue reads register file
-void cycle_stage_4_cpr()
+// scheduling queue reads register file
+void cycle_stage_4_rob()
 {
     // update max size
     if (dq_size > dq_max_size) {
@@ -1085,13 +1293,24 @@ void cycle_stage_4_cpr()
 
     dq_size_sum += dq_size;
 
+    unsigned long dispatched = 0;
+
     // if the scheduling queue is full
     // or the dispatch queue is empty
+    // or the dispatch width is used up
     // then exit loop
-    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end();) {
+    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end() && dispatched < dispatch_width;) {
 
         // scheduling queue is full
         if (sq_size == sq_max_size) {
+            sq_full_stall = true;
+            break;
+        }
+
+        // so are the reorder buffer and the register file, counted as a
+        // full window
+        if (rob.size() >= rob_capacity || prf_full(*iterator)) {
+            sq_full_stall = true;
             break;
         }
 
@@ -1107,6 +1326,32 @@ void cycle_stage_4_cpr()
 
         inst->state = State::DISPATCHED;
 
+        for (int i = 0; i < 2; ++i) {
+
+            if (inst->src_reg[i] != -1) {
+
+                // check ROB
+                bool found = false;
+                for (list<proc_inst_t*>::reverse_iterator iterator = rob.rbegin(); iterator != rob.rend(); ++iterator) {
+
+                    proc_inst_t* rob_inst = *iterator;
+
+                    if (rob_inst->dest_reg == inst->src_reg[i]) {
+
+                        found = true;
+                        break;
+                    }
+                }
+
+                // check register file
+                if (found) {
+                    rob_hit_counter++;
+                } else {
+                    reg_hit_counter++;
+                }
+            }
+        }
+
         for (int i = 0; i < 2; ++i) {
 
             if (inst->src_reg[i] == -1) {
@@ -1116,32 +1361,35 @@ void cycle_stage_4_cpr()
             } else if (reg[inst->src_reg[i]].ready) {
 
                 inst->src_ready[i] = true;
-                reg_hit_counter++;
 
             } else {
 
                 inst->src_tag[i] = reg[inst->src_reg[i]].tag;
                 inst->src_ready[i] = false;
-                reg_hit_counter++;
             }
         }
 
         // assign new tag to destination register
         if (inst->dest_reg > -1) {
 
+            if (prf_size != 0) {
+                rename_dest(inst);
+            }
+
             reg[inst->dest_reg].tag = reg_tag_counter;
             reg[inst->dest_reg].ready = false;
-            uint32_t ib_inst_tag = (ib1 == nullptr ? 20 : ib1->inst_tag);
-            if (inst->inst_tag <= ib_inst_tag) {
-                backup_1[inst->dest_reg].tag = reg_tag_counter;
-                backup_1[inst->dest_reg].ready = false;
-            }
             inst->dest_tag = reg_tag_counter;
             reg_tag_counter++;
         }
 
         sq.push_back(inst);
         sq_size++;
+        dispatched++;
+
+        rob.push_back(inst);
+        rob.sort([](proc_inst_t* x, proc_inst_t* y) {
+            return x->inst_tag < y->inst_tag;
+        });
     }
 
     // scheduling queue reads register file
@@ -1165,7 +1413,7 @@ void cycle_stage_4_cpr()
 }
 
 // deletes retired instructions from the scheduling queue
-void cycle_stage_5_cpr()
+void cycle_stage_5_rob()
 {
     for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end();) {
 
@@ -1178,27 +1426,56 @@ void cycle_stage_5_cpr()
             ++iterator;
         }
     }
+
+    for (list<proc_inst_t*>::iterator iterator = rob.begin(); iterator != rob.end();) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->state == State::RETIRED) {
+            iterator = rob.erase(iterator);
+        } else {
+            ++iterator;
+        }
+    }
+
+    // a flush refetches from the oldest instruction yet to retire
+    release_instructions(UINT64_MAX);
 }
 
 // fetch instructions
-// update cycle counter
-void cycle_stage_6_cpr()
+void cycle_stage_6_rob()
 {
     for (unsigned long i = 0; i < f; ++i) {
 
+        // an I-cache miss stalls fetch until the line arrives
+        if (cycle_counter < fetch_ready) {
+            break;
+        }
+
+        // a full dispatch queue holds fetch back
+        if (dq_size >= dq_capacity) {
+            break;
+        }
+
         bool trailing = trailing_inst_tag < inst_tag_counter;
         proc_inst_t* inst;
         bool success;
 
         if (trailing) {
 
-            inst = *trailing_ptr;
+            inst = instructions[trailing_inst_tag - instructions_base];
+
+            // refetched instructions go through the I-cache again
+            if (icache_sets != 0 && !icache_access(inst->instruction_address)) {
+                break;
+            }
+
             success = true;
 
         } else {
 
-            inst = new proc_inst_t;
-            success = read_instruction(inst);
+            inst = new_instruction();
+            success = fetch_instruction(inst);
         }
 
         if (success) {
@@ -1219,7 +1496,14 @@ void cycle_stage_6_cpr()
 
                 inst->fu = abs(inst->op_code);
                 inst->exception = !(inst_tag_counter % e);
+                inst->thread = smt_current;
                 inst->inst_tag = inst_tag_counter++;
+                link_producers(inst);
+
+                // fetch runs on past a mispredicted branch, and what it
+                // fetches is flushed when the branch is repaired
+                inst->mispredict = bpred_kind != BPRED_PERFECT
+                    && !bpred_predict(inst->instruction_address, inst->taken);
                 //char log_line[80];
                 //sprintf(log_line, "%lu\tFETCHED\t%u\n", cycle_counter, inst->inst_tag);
                 //log_file << log_line;
@@ -1230,19 +1514,8 @@ void cycle_stage_6_cpr()
             inst->fetch = cycle_counter;
             inst->disp = cycle_counter + 1;
 
-            if (instructions.empty()) {
+            if (!trailing) {
                 instructions.push_back(inst);
-                trailing_ptr = instructions.begin();
-            } else if (!trailing) {
-                instructions.push_back(inst);
-                trailing_ptr++;
-            } else {
-                trailing_ptr++;
-            }
-
-            // first instruction barrier
-            if (ib1 == nullptr && inst->inst_tag == 20) {
-                ib1 = inst;
             }
 
             // insert instruction into dispatch queue
@@ -1253,105 +1526,1300 @@ void cycle_stage_6_cpr()
             //if (dq_size > dq_max_size) {
             //    dq_max_size = dq_size;
             //}
+
+        } else {
+
+            inst_pool.push_back(inst);
         }
     }
 
     //dq_size_sum += dq_size;
-    cycle_counter++;
 }
 
-//================//
-// Driver Methods //
-//================//
+//=====================//
+//=====================//
+//  CHECKPOINT REPAIR  //
+//=====================//
+//=====================//
 
-/**
- * Subroutine for initializing the processor. You many add and initialize any global or heap
- * variables as needed.
- * XXX: You're responsible for completing this routine
- *
- * @r Number of result buses
- * @k0 Number of k0 FUs
- * @k1 Number of k1 FUs
- * @k2 Number of k2 FUs
- * @f Number of instructions to fetch
- */
-void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f, uint64_t e, uint64_t s) 
+static inline checkpoint_t& checkpoint(unsigned long i)
 {
-    //log_file.open("log");
+    return checkpoints[(ckpt_head + i) % ckpt_max];
+}
 
-    ::r = r;
-    k[0] = k0;
-    k[1] = k1;
-    k[2] = k2;
-    ::f = f;
-    ::e = e;
-    ::s = s;
+// checkpoints the map after the youngest dispatched instruction
+static inline void push_checkpoint(uint64_t inst_tag)
+{
+    checkpoint_t& c = checkpoint(ckpt_count++);
+    c.inst_tag = inst_tag;
+    c.journal = journal_base + journal.size();
+    c.epoch = ++epoch_counter;
+}
 
-    if (e == 0) {
-        ::e = UINT64_MAX;
+// checkpoints the map after a dispatched instruction once a checkpoint is
+// free and it reaches the barrier, or an interval past the newest checkpoint
+static inline void take_checkpoint(const proc_inst_t* inst)
+{
+    uint64_t next = ckpt_interval == 0 ? ckpt_barrier : checkpoint(ckpt_count - 1).inst_tag + ckpt_interval;
+
+    if (ckpt_count == ckpt_max || inst->inst_tag < next) {
+        return;
     }
 
-    sq_max_size = 2 * (k0 + k1 + k2);
+    push_checkpoint(inst->inst_tag);
+    ckpt_barrier = UINT64_MAX;
+}
 
-    reg = new reg_t[128];
-    backup_1 = new reg_t[128];
-    backup_2 = new reg_t[128];
+// checkpoints the map early when dispatch runs out of physical registers
+// with none in flight, since the registers journaled since the committed
+// checkpoint only free once another commits
+static inline void force_checkpoint()
+{
+    if (ckpt_count > 1 || journal.empty()) {
+        return;
+    }
 
-    cdb = new proc_inst_t*[r];
+    push_checkpoint(dispatch_tag);
+    ckpt_barrier = UINT64_MAX;
+}
 
-    dummy_inst = new proc_inst_t;
-    dummy_inst->inst_tag = UINT32_MAX;
-    dummy_inst->dest_tag = UINT32_MAX;
+// records the map entry of a register about to be renamed, unless it was
+// already renamed since the newest checkpoint, its physical register stays
+// allocated while a rollback may restore it
+static inline void journal_write(int32_t reg_index)
+{
+    uint64_t epoch = checkpoint(ckpt_count - 1).epoch;
 
-    for (int i = 0; i < 128; ++i) {
-        reg[i].tag = i;
-        backup_1[i].tag = i;
-        backup_2[i].tag = i;
+    if (journal_epoch[reg_index] == epoch) {
+        return;
+    }
+
+    journal_epoch[reg_index] = epoch;
+    journal_entry_t entry = {reg[reg_index], reg_index};
+    journal.push_back(entry);
+
+    if (prf_size != 0) {
+        preg_holds[entry.old.preg]++;
     }
 }
 
-/**
- * Subroutine that simulates the processor.
- *   The processor should fetch instructions as appropriate, until all instructions have executed
- * XXX: You're responsible for completing this routine
- *
- * @p_stats Pointer to the statistics structure
- */
-void run_proc(proc_stats_t* p_stats)
+// commits the oldest checkpoint in flight once everything up to it retired,
+// which frees it for the youngest dispatched instruction
+static inline void commit_checkpoints()
 {
-    //log_file << "CYCLE\tOPERATION\tINSTRUCTION\n";
-    bool debug = false;
+    while (ckpt_count > 1) {
 
-    do {
+        uint64_t barrier = checkpoint(1).inst_tag;
 
-        if (debug) printf("begin stage 0\n");
-        stage_0[s]();
-        if (debug) printf("begin stage 1\n");
-        stage_1[s]();
-        if (debug) printf("begin stage 2\n");
-        stage_2[s]();
-        if (debug) printf("begin stage 3\n");
-        stage_3[s]();
-        if (debug) printf("begin stage 4\n");
-        stage_4[s]();
-        if (debug) printf("begin stage 5\n");
-        stage_5[s]();
-        if (debug) printf("begin stage 6\n");
-        stage_6[s]();
+        // the scheduling queue holds each thread in program order
+        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
 
-    } while (!(sq.empty() && dq.empty()));
-}
+            proc_inst_t* inst = *iterator;
 
-/**
- * Subroutine for cleaning up any outstanding instructions and calculating overall statistics
- * such as average IPC, average fire rate etc.
- * XXX: You're responsible for completing this routine
- *
- * @p_stats Pointer to the statistics structure
- */
-void complete_proc(proc_stats_t *p_stats) 
-{
-    //log_file.close();
+            if (inst->thread != smt_current) {
+                continue;
+            }
+
+            if (inst->inst_tag > barrier) {
+                break;
+            }
+
+            if (inst->state != State::RETIRED) {
+                return;
+            }
+        }
+
+        //char log_line[80];
+        //sprintf(log_line, "%lu\tCOMMIT\t%u\tTO\t%u\n", cycle_counter, checkpoint(0).inst_tag + 1, barrier);
+        //log_file << log_line;
+
+        retired_counter += barrier - checkpoint(0).inst_tag;
+        smt_retired[smt_current] += barrier - checkpoint(0).inst_tag;
+        backup_counter++;
+
+        ckpt_head = (ckpt_head + 1) % ckpt_max;
+        ckpt_count--;
+
+        // nothing can roll back past the committed checkpoint
+        while (journal_base < checkpoint(0).journal) {
+            if (prf_size != 0) {
+                release_preg(journal.front().old.preg);
+            }
+            journal.pop_front();
+            journal_base++;
+        }
+
+        if (ckpt_interval != 0) {
+            take_checkpoint(youngest_dispatched());
+            continue;
+        }
+
+        // without an interval the freed checkpoint goes to the queue tail,
+        // which may be the one just committed, so the next retirement
+        // commits again
+        push_checkpoint(youngest_dispatched()->inst_tag);
+        return;
+    }
+}
+
+// restores the newest checkpoint older than the instruction with inst_tag,
+// or the committed one when checkpoints follow the queue tail, and flushes
+// everything after it, older instructions keep executing
+static void rollback_checkpoint(uint64_t inst_tag)
+{
+    // dispatch retakes a checkpoint at the queue tail as it passes it again
+    while (ckpt_count > 1 && (ckpt_interval == 0 || checkpoint(ckpt_count - 1).inst_tag >= inst_tag)) {
+        ckpt_barrier = checkpoint(--ckpt_count).inst_tag;
+    }
+
+    checkpoint_t& c = checkpoint(ckpt_count - 1);
+
+    flushed_counter += youngest_dispatched()->inst_tag - c.inst_tag;
+
+    dq.clear();
+    dq_size = 0;
+
+    flush_window_after(c.inst_tag);
+    flush_execution_after(c.inst_tag);
+
+    for (unsigned long i = 0; i < r; ++i) {
+        cdb[i] = dummy_inst;
+    }
+
+    // undo the renames since the checkpoint, newest first, the results
+    // restored are ready unless an instruction left still produces them
+    while (journal_base + journal.size() > c.journal) {
+
+        const journal_entry_t& entry = journal.back();
+        reg[entry.reg_index] = entry.old;
+        reg[entry.reg_index].ready = true;
+        journal.pop_back();
+    }
+
+    // registers journaled under the old epoch were just restored
+    c.epoch = ++epoch_counter;
+
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->dest_reg > -1 && inst->state < State::COMPLETED && reg[inst->dest_reg].tag == inst->dest_tag) {
+            reg[inst->dest_reg].ready = false;
+        }
+    }
+
+    reset_prf();
+
+    trailing_inst_tag = c.inst_tag + 1;
+    dispatch_tag = c.inst_tag;
+}
+
+// mark completed intstructions as retired
+void cycle_stage_0_cpr()
+{
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->state == State::COMPLETED && inst->thread == smt_current) {
+
+            if (inst->exception || inst->mispredict) {
+
+                // both roll back to the newest checkpoint before the
+                // instruction, a mispredicted branch is refetched with the
+                // right path behind it
+                if (inst->exception) {
+
+                    //char log_line[80];
+                    //sprintf(log_line, "%lu\tEXCEPTION\t%u\n", cycle_counter, inst->inst_tag);
+                    //log_file << log_line;
+
+                    exception_counter++;
+                }
+
+                inst->exception = false;
+                inst->mispredict = false;
+
+                // handle exception
+                rollback_checkpoint(inst->inst_tag);
+
+                // the flush costs a cycle, then the window refills
+                stall_slots[STALL_REFILL] += f;
+                refilling = true;
+
+                cycle_counter++;
+                break;
+
+            } else {
+
+                inst->state = State::RETIRED;
+                retired_this_cycle++;
+                retire_dest(inst);
+
+                //char log_line[80];
+                //sprintf(log_line, "%lu\tSTATE UPDATE\t%u\n", cycle_counter, inst->inst_tag);
+                //log_file << log_line;
+
+                inst->update = cycle_counter;
+                digest_retire(inst);
+            }
+
+            commit_checkpoints();
+        }
+    }
+}
+
+// broadcast results on result buses
+// mark instructions as completed
+// update register files
+void cycle_stage_1_cpr()
+{
+    finish_execution();
+
+    unsigned long buses_used = 0;
+
+    // if all cdbs are used
+    // or there are no instructions waiting to be broadcast
+    // then exit loop
+    for (list<proc_inst_t*>::iterator iterator = sb.begin(); iterator != sb.end() && buses_used < r;) {
+
+        proc_inst_t* inst = *iterator;
+
+        // put results on bus and free FU
+        // a pipelined FU is only held by a result stuck waiting for a bus
+        cdb[buses_used] = inst;
+        buses_used++;
+        if (!fu_pipelined[inst->fu] || inst->state == State::EXECUTED) {
+            fu_busy_counter[inst->fu]--;
+        }
+
+        if (inst->state != State::EXECUTED) {
+            inst->state = State::EXECUTED;
+
+            //char log_line[80];
+            //sprintf(log_line, "%lu\tEXECUTED\t%u\n", cycle_counter, inst->inst_tag);
+            //log_file << log_line;
+        }
+
+        //char log_line[80];
+        //sprintf(log_line, "%lu\tBROADCASTED\t%u\n", cycle_counter, inst->inst_tag);
+        //log_file << log_line;
+
+        iterator = sb.erase(iterator);
+    }
+
+    hold_finished();
+
+    // set tags of unused buses to infinity to prevent them from updating things
+    for (unsigned long i = buses_used; i < r; ++i) {
+        cdb[i] = dummy_inst;
+    }
+
+    // mark instruction as completed in scheduling queue
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+
+        proc_inst_t* inst = *iterator;
+
+        // check each result bus
+        for (unsigned long j = 0; j < r; ++j) {
+            if (inst->state == State::EXECUTED && inst == cdb[j]) {
+
+                inst->state = State::COMPLETED;
+                break;
+            }
+        }
+    }
+
+    // update register file
+    update_reg_file();
+}
+
+// fire instructions in the scheduling queue
+void cycle_stage_2_cpr()
+{
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->src_ready[0]
+            && inst->src_ready[1]
+            && fu_busy_counter[inst->fu] < k[inst->fu]
+            && inst->state == State::DISPATCHED) {
+
+            inst->state = State::FIRED;
+            fired_counter++;
+            start_execution(inst);
+
+            //char log_line[80];
+            //sprintf(log_line, "%lu\tSCHEDULED\t%u\n", cycle_counter, inst->inst_tag);
+            //log_file << log_line;
+
+            inst->exec = cycle_counter + 1;
+        }
+    }
+}
+
+// update scheduling queue via result buses
+void cycle_stage_3_cpr()
+{
+    // for each result bus
+    for (unsigned long j = 0; j < r; ++j) {
+        wake_consumers(cdb[j]);
+    }
+}
+
+// dispatch instructions to scheduling queue
+// dispatch queue reads register file
+void cycle_stage_4_cpr()
+{
+    // update max size
+    if (dq_size > dq_max_size) {
+        dq_max_size = dq_size;
+    }
+
+    dq_size_sum += dq_size;
+
+    unsigned long dispatched = 0;
+
+    // if the scheduling queue is full
+    // or the dispatch queue is empty
+    // or the dispatch width is used up
+    // then exit loop
+    for (list<proc_inst_t*>::iterator iterator = dq.begin(); iterator != dq.end() && dispatched < dispatch_width;) {
+
+        // scheduling queue is full
+        if (sq_size == sq_max_size) {
+            sq_full_stall = true;
+            break;
+        }
+
+        // so is the register file, counted as a full window
+        if (prf_full(*iterator)) {
+            force_checkpoint();
+            sq_full_stall = true;
+            break;
+        }
+
+        proc_inst_t* inst = *iterator;
+        iterator = dq.erase(iterator);
+        dq_size--;
+
+        //char log_line[80];
+        //sprintf(log_line, "%lu\tDISPATCHED\t%u\n", cycle_counter, inst->inst_tag);
+        //log_file << log_line;
+
+        inst->sched = cycle_counter + 1;
+
+        inst->state = State::DISPATCHED;
+        dispatch_tag = inst->inst_tag;
+
+        for (int i = 0; i < 2; ++i) {
+
+            if (inst->src_reg[i] == -1) {
+
+                inst->src_ready[i] = true;
+
+            } else if (reg[inst->src_reg[i]].ready) {
+
+                inst->src_ready[i] = true;
+                reg_hit_counter++;
+
+            } else {
+
+                inst->src_tag[i] = reg[inst->src_reg[i]].tag;
+                inst->src_ready[i] = false;
+                reg_hit_counter++;
+            }
+        }
+
+        // assign new tag to destination register
+        if (inst->dest_reg > -1) {
+
+            journal_write(inst->dest_reg);
+
+            if (prf_size != 0) {
+                rename_dest(inst);
+            }
+
+            reg[inst->dest_reg].tag = reg_tag_counter;
+            reg[inst->dest_reg].ready = false;
+            inst->dest_tag = reg_tag_counter;
+            reg_tag_counter++;
+        }
+
+        sq.push_back(inst);
+        sq_size++;
+        dispatched++;
+
+        take_checkpoint(inst);
+    }
+
+    // scheduling queue reads register file
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->state == State::DISPATCHED) {
+            // set instruction ready bits
+            for (int i = 0; i < 2; ++i) {
+
+                if (inst->src_ready[i] == false) {
+                    if (reg[inst->src_reg[i]].tag == inst->src_tag[i] && reg[inst->src_reg[i]].ready) {
+
+                        inst->src_ready[i] = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// deletes retired instructions from the scheduling queue
+void cycle_stage_5_cpr()
+{
+    for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end();) {
+
+        proc_inst_t* inst = *iterator;
+
+        if (inst->state == State::RETIRED) {
+            iterator = sq.erase(iterator);
+            sq_size--;
+        } else {
+            ++iterator;
+        }
+    }
+
+    // a rollback refetches from past the checkpoint it restores, and one
+    // taken at the queue tail may be older than the committed one
+    uint64_t oldest = checkpoint(0).inst_tag;
+    for (unsigned long i = 1; i < ckpt_count; ++i) {
+        oldest = min(oldest, checkpoint(i).inst_tag);
+    }
+
+    release_instructions(oldest);
+}
+
+// fetch instructions
+void cycle_stage_6_cpr()
+{
+    for (unsigned long i = 0; i < f; ++i) {
+
+        // an I-cache miss stalls fetch until the line arrives
+        if (cycle_counter < fetch_ready) {
+            break;
+        }
+
+        // a full dispatch queue holds fetch back
+        if (dq_size >= dq_capacity) {
+            break;
+        }
+
+        bool trailing = trailing_inst_tag < inst_tag_counter;
+        proc_inst_t* inst;
+        bool success;
+
+        if (trailing) {
+
+            inst = instructions[trailing_inst_tag - instructions_base];
+
+            // refetched instructions go through the I-cache again
+            if (icache_sets != 0 && !icache_access(inst->instruction_address)) {
+                break;
+            }
+
+            success = true;
+
+        } else {
+
+            inst = new_instruction();
+            success = fetch_instruction(inst);
+        }
+
+        if (success) {
+
+            // initialize instruction
+            inst->dest_tag = UINT32_MAX;
+            inst->src_ready[0] = false;
+            inst->src_ready[1] = false;
+            inst->state = State::FETCHED;
+
+            if (trailing) {
+
+                //char log_line[80];
+                //sprintf(log_line, "%lu\tRE-FETCHED\t%u\n", cycle_counter, inst->inst_tag);
+                //log_file << log_line;
+
+            } else {
+
+                inst->fu = abs(inst->op_code);
+                inst->exception = !(inst_tag_counter % e);
+                inst->thread = smt_current;
+                inst->inst_tag = inst_tag_counter++;
+                link_producers(inst);
+
+                // fetch runs on past a mispredicted branch, and what it
+                // fetches is flushed when the branch is repaired
+                inst->mispredict = bpred_kind != BPRED_PERFECT
+                    && !bpred_predict(inst->instruction_address, inst->taken);
+                //char log_line[80];
+                //sprintf(log_line, "%lu\tFETCHED\t%u\n", cycle_counter, inst->inst_tag);
+                //log_file << log_line;
+            }
+
+            trailing_inst_tag++;
+
+            inst->fetch = cycle_counter;
+            inst->disp = cycle_counter + 1;
+
+            if (!trailing) {
+                instructions.push_back(inst);
+            }
+
+            // insert instruction into dispatch queue
+            dq.push_back(inst);
+            dq_size++;
+
+            // update max size
+            //if (dq_size > dq_max_size) {
+            //    dq_max_size = dq_size;
+            //}
+
+        } else {
+
+            inst_pool.push_back(inst);
+        }
+    }
+
+    //dq_size_sum += dq_size;
+}
+
+//================//
+// Driver Methods //
+//================//
+
+// gives the running SMT thread an empty front end and its initial map, on
+// physical registers of its own
+static void reset_thread()
+{
+    instructions.clear();
+    instructions_base = 1;
+    dq.clear();
+    rob.clear();
+    dq_size = 0;
+
+    inst_tag_counter = 1;
+    trailing_inst_tag = 1;
+
+    icache_last_line = UINT64_MAX;
+    icache_fill_line = UINT64_MAX;
+    fetch_ready = 0;
+    fetch_waiting = false;
+    fetch_holding = false;
+    fetch_exhausted = false;
+    fetch_blocker = nullptr;
+
+    reg = new reg_t[128];
+    arch_preg.resize(128);
+
+    for (int i = 0; i < 128; ++i) {
+        reg[i].tag = i;
+        reg[i].preg = smt_current * 128 + i;
+        arch_preg[i] = reg[i].preg;
+    }
+
+    // the committed checkpoint is the initial map, with nothing to undo
+    checkpoints.resize(ckpt_max);
+    ckpt_head = 0;
+    ckpt_count = 1;
+    checkpoints[0].inst_tag = 0;
+    checkpoints[0].journal = 0;
+    checkpoints[0].epoch = ++epoch_counter;
+    ckpt_barrier = DEFAULT_CKPT_INTERVAL;
+    dispatch_tag = 0;
+    journal.clear();
+    journal_base = 0;
+    journal_epoch.assign(128, 0);
+}
+
+/**
+ * Subroutine for initializing the processor. You many add and initialize any global or heap
+ * variables as needed.
+ * XXX: You're responsible for completing this routine
+ *
+ * @r Number of result buses
+ * @k0 Number of k0 FUs
+ * @k1 Number of k1 FUs
+ * @k2 Number of k2 FUs
+ * @f Number of instructions to fetch
+ */
+void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f, uint64_t e, uint64_t s) 
+{
+    //log_file.open("log");
+
+    // the wheel must cover the longest latency
+    uint64_t slots = 1;
+    while (slots <= fu_latency[0] || slots <= fu_latency[1] || slots <= fu_latency[2]) {
+        slots *= 2;
+    }
+    completions.resize(slots);
+    wheel_mask = slots - 1;
+    flush_execution();
+    sq.clear();
+
+    dq_max_size = 0;
+    dq_size_sum = 0;
+    sq_size = 0;
+
+    reg_tag_counter = 128;
+    cycle_counter = 1;
+    fired_counter = 1;
+    retired_counter = 1;
+    flushed_counter = 1;
+    exception_counter = 1;
+    backup_counter = 1;
+    rob_hit_counter = 1;
+    reg_hit_counter = 1;
+
+    icache_tags.assign(icache_sets * icache_assoc, UINT64_MAX);
+    icache_used.assign(icache_sets * icache_assoc, 0);
+    icache_clock = 0;
+    icache_access_counter = 0;
+    icache_miss_counter = 0;
+    bpred_reset();
+
+
+    sync_countdown = sync_quantum;
+
+    conv_countdown = conv_interval;
+    conv_samples = 0;
+    conv_last_retired = retired_counter;
+    conv_mean = 0;
+    conv_m2 = 0;
+
+    if (tele_interval) {
+        tele_countdown = tele_interval;
+        tele_last_retired = retired_counter;
+        tele_ring = new telemetry_sample_t[TELEMETRY_RING_SIZE];
+        tele_count = 0;
+
+        if (!tele_binary) {
+            fprintf(tele_out, "cycle,dq,sq,rob,sb,buses,fu0,fu1,fu2,retired\n");
+        }
+    }
+
+    for (int i = 0; i < NUM_STALL_CAUSES; ++i) {
+        stall_slots[i] = 0;
+    }
+    retired_this_cycle = 0;
+    sq_full_stall = false;
+    refilling = false;
+
+    for (int i = 0; i < 7; ++i) {
+        stage_ticks[i] = 0;
+    }
+
+    timing_digest = 0xcbf29ce484222325ULL;
+
+    ::r = r;
+    k[0] = k0;
+    k[1] = k1;
+    k[2] = k2;
+    ::f = f;
+    ::e = e;
+    ::s = s;
+
+    if (e == 0) {
+        ::e = UINT64_MAX;
+    }
+
+    sq_max_size = sq_entries != 0 ? sq_entries : 2 * (k0 + k1 + k2);
+
+    cdb = new proc_inst_t*[r];
+
+    dummy_inst = new proc_inst_t;
+    dummy_inst->inst_tag = UINT64_MAX;
+    dummy_inst->dest_tag = UINT32_MAX;
+    dummy_inst->dest_reg = -1;
+
+    // every SMT thread starts afresh, thread 0 last so it is the one running
+    smt_current = 0;
+    smt_parked.assign(smt_threads, smt_thread_t());
+    smt_fetch_next = 0;
+    epoch_counter = 0;
+
+    for (unsigned int t = 0; t < SMT_MAX_THREADS; ++t) {
+        smt_drain_cycle[t] = 0;
+        smt_retired[t] = 0;
+    }
+
+    for (unsigned int t = smt_threads; t-- > 0;) {
+        switch_thread(t);
+        reset_thread();
+    }
+    reset_prf();
+}
+
+/**
+ * Enables early termination once the IPC has converged. The IPC of each interval
+ * of retirement is sampled, and the run stops when the 95% confidence bound on
+ * the mean interval IPC is within tolerance percent of the mean. Intervals are
+ * treated as independent samples, so the bound is optimistic for phased traces.
+ * Must be called before setup_proc.
+ *
+ * @interval Cycles per sample, 0 to always run the whole trace
+ * @tolerance Half-width of the confidence bound as a percent of the mean
+ */
+void setup_convergence(uint64_t interval, double tolerance)
+{
+    conv_interval = interval;
+    conv_tolerance = tolerance;
+}
+
+/**
+ * Limits the run to a prefix of the trace. Once the budget is fetched the
+ * processor stops reading and drains, exactly as if the trace ended there.
+ * Must be called before setup_proc.
+ *
+ * @budget Number of instructions to simulate, 0 for the whole trace
+ */
+void setup_budget(uint64_t budget)
+{
+    inst_budget = budget == 0 ? UINT64_MAX : budget;
+}
+
+/**
+ * Bounds the dispatch queue and the dispatch rate. Fetch stops for the cycle
+ * once the queue is full, and dispatch moves at most width instructions into
+ * the scheduling queue per cycle. Must be called before setup_proc.
+ *
+ * @capacity Dispatch queue entries, 0 for an unbounded queue
+ * @width Instructions dispatched per cycle, 0 for as many as fit
+ */
+void setup_dispatch(uint64_t capacity, uint64_t width)
+{
+    dq_capacity = capacity == 0 ? UINT64_MAX : capacity;
+    dispatch_width = width == 0 ? UINT64_MAX : width;
+}
+
+/**
+ * Sizes the instruction window. Renaming takes a physical register from a
+ * free list, and dispatch stalls while the scheduling queue, the reorder
+ * buffer or the free list runs out. A register is freed once its producer
+ * and the next writer of its architectural register have both retired, and
+ * a flush frees everything but the state it restores. Tags still name
+ * results uniquely, so a recycled register never wakes a stale consumer.
+ * Must be called before setup_proc.
+ *
+ * @sq Scheduling queue entries, 0 for 2 per FU
+ * @rob Reorder buffer entries, 0 for an unbounded reorder buffer
+ * @prf Physical registers, more than 128, or 0 for an unbounded file
+ */
+void setup_window(uint64_t sq, uint64_t rob, uint64_t prf)
+{
+    sq_entries = sq;
+    rob_capacity = rob == 0 ? UINT64_MAX : rob;
+    prf_size = prf > 128 ? prf : 0;
+}
+
+/**
+ * Sets the checkpoints CPR keeps. The oldest commits once everything before
+ * the next has retired, and an exception rolls back to the newest checkpoint
+ * before it. By default the first checkpoint is taken DEFAULT_CKPT_INTERVAL
+ * instructions in and each commit takes the next at the scheduling queue
+ * tail, which never fills more than two, so more need an interval, after
+ * which dispatch checkpoints the register map whenever one is free. Must be
+ * called before setup_proc.
+ *
+ * @count Checkpoints including the committed one, at least 2, 0 for the default
+ * @interval Instructions between checkpoints, 0 for the queue tail
+ */
+void setup_checkpoints(uint64_t count, uint64_t interval)
+{
+    ckpt_max = count == 0 ? DEFAULT_CKPTS : count < 2 ? 2 : count;
+    ckpt_interval = interval == 0 && ckpt_max > 2 ? DEFAULT_CKPT_INTERVAL : interval;
+}
+
+/**
+ * Runs several traces on one core. Each SMT thread renames through its own
+ * map and keeps its own dispatch queue, reorder buffer or checkpoints and
+ * refetch pointer, while the scheduling queue, FUs, result buses, register
+ * file, I-cache and branch predictor are shared. One thread fetches each
+ * cycle, picked round-robin or by ICOUNT, fewest instructions waiting to
+ * issue first, and the threads share the dispatch width. A bounded register
+ * file needs more than 128 registers per thread. Must be called before
+ * setup_proc.
+ *
+ * @threads Traces run at once, at most SMT_MAX_THREADS
+ * @policy How fetch picks a thread
+ */
+void setup_smt(uint64_t threads, FetchPolicy policy)
+{
+    smt_threads = threads < 1 ? 1 : threads > SMT_MAX_THREADS ? SMT_MAX_THREADS : threads;
+    fetch_policy = policy;
+}
+
+/**
+ * Makes this core one of a multicore run. The hook is called every quantum
+ * cycles and returns once every core still running has reached the same
+ * cycle, so the cores advance in lockstep however the host schedules their
+ * threads. Must be called before setup_proc.
+ *
+ * @hook Barrier the cores meet at, nullptr to run alone
+ * @quantum Cycles between meetings
+ */
+void setup_sync(FP hook, uint64_t quantum)
+{
+    sync_hook = hook;
+    sync_quantum = hook == nullptr ? 0 : quantum;
+}
+
+/**
+ * Sets the execution latency of each FU class. A pipelined class takes a new
+ * instruction on each of its FUs every cycle, an unpipelined one holds the FU
+ * until the result is broadcast. Must be called before any run starts.
+ *
+ * @latency Cycles each class takes to execute, at least 1
+ * @pipelined Whether each class is pipelined
+ */
+void setup_latency(const uint64_t latency[3], const bool pipelined[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        fu_latency[i] = latency[i] < 1 ? 1 : latency[i];
+        fu_pipelined[i] = pipelined[i];
+    }
+}
+
+/**
+ * Puts a set-associative LRU I-cache on the fetch path. A miss fills the line
+ * and stalls fetch for the miss latency, refetches after a flush look the line
+ * up again. Sizes must be powers of two. Must be called before any run starts.
+ *
+ * @size Capacity in bytes, 0 for a perfect I-cache
+ * @line Line size in bytes
+ * @assoc Number of ways
+ * @latency Cycles a miss stalls fetch
+ */
+void setup_icache(uint64_t size, uint64_t line, uint64_t assoc, uint64_t latency)
+{
+    icache_sets = size / (line * assoc);
+    icache_assoc = assoc;
+    icache_latency = latency;
+
+    icache_line_bits = 0;
+    while ((2ULL << icache_line_bits) <= line) {
+        icache_line_bits++;
+    }
+}
+
+/**
+ * Enables per-cycle occupancy telemetry. Samples go into a preallocated ring
+ * that is written out whenever it fills and at the end of the run, so the only
+ * cost while disabled is one test per cycle. Must be called before setup_proc.
+ *
+ * @out File the samples are written to
+ * @interval Cycles between samples, 0 to disable telemetry
+ * @binary Write raw telemetry_sample_t records instead of CSV
+ */
+void setup_telemetry(FILE* out, uint64_t interval, bool binary)
+{
+    tele_out = out;
+    tele_interval = out == nullptr ? 0 : interval;
+    tele_binary = binary;
+}
+
+// write out the buffered telemetry samples
+static void flush_telemetry()
+{
+    if (tele_binary) {
+        fwrite(tele_ring, sizeof(telemetry_sample_t), tele_count, tele_out);
+    } else {
+        for (unsigned long i = 0; i < tele_count; ++i) {
+            const telemetry_sample_t& t = tele_ring[i];
+            fprintf(tele_out, "%lu,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long) t.cycle,
+                    t.dq_size, t.sq_size, t.rob_size, t.sb_size, t.buses_used,
+                    t.fu_busy[0], t.fu_busy[1], t.fu_busy[2], t.retired);
+        }
+    }
+
+    tele_count = 0;
+}
+
+// record the occupancy of the cycle that just ended
+static void sample_telemetry()
+{
+    telemetry_sample_t& t = tele_ring[tele_count++];
+
+    t.cycle = cycle_counter - 1;
+    t.dq_size = dq_size;
+    t.sq_size = sq_size;
+    t.rob_size = rob.size();
+    t.sb_size = sb.size() + executing;
+    t.buses_used = 0;
+    for (unsigned long i = 0; i < r; ++i) {
+        t.buses_used += cdb[i] != dummy_inst;
+    }
+    for (int i = 0; i < 3; ++i) {
+        t.fu_busy[i] = fu_busy_counter[i];
+    }
+    t.retired = retired_counter - tele_last_retired;
+
+    tele_last_retired = retired_counter;
+    tele_countdown = tele_interval;
+
+    if (tele_count == TELEMETRY_RING_SIZE) {
+        flush_telemetry();
+    }
+}
+
+// charge the retire slots left empty this cycle to whatever holds up
+// the oldest instruction that has not completed yet
+static void account_cycle()
+{
+    unsigned long missing = retired_this_cycle < f ? f - retired_this_cycle : 0;
+
+    stall_slots[STALL_BASE] += f - missing;
+
+    if (retired_this_cycle > 0) {
+        refilling = false;
+    }
+
+    if (missing > 0) {
+
+        proc_inst_t* oldest = nullptr;
+
+        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+            if ((*iterator)->state != State::COMPLETED && (*iterator)->state != State::RETIRED) {
+                oldest = *iterator;
+                break;
+            }
+        }
+
+        Stall cause;
+
+        if (refilling) {
+
+            cause = STALL_REFILL;
+
+        } else if (oldest == nullptr) {
+
+            // everything in the window is done, so the window is too small
+            // or the front end did not deliver enough instructions
+            cause = sq_full_stall ? STALL_SQ_FULL : STALL_FRONTEND;
+
+        } else if (oldest->state == State::EXECUTED) {
+
+            // finished but lost result bus arbitration
+            cause = STALL_BUS;
+
+        } else if (oldest->state == State::FIRED) {
+
+            // its first cycle executing is latency on the dependence chain,
+            // only the cycles a multi-cycle FU takes beyond it are not
+            cause = cycle_counter > oldest->exec ? STALL_EXECUTION : STALL_DEPENDENCE;
+
+        } else if (oldest->src_ready[0] && oldest->src_ready[1]
+                   && fu_busy_counter[oldest->fu] >= k[oldest->fu]) {
+
+            cause = STALL_FU;
+
+        } else if (sq_full_stall) {
+
+            // a larger window could have found independent work
+            cause = STALL_SQ_FULL;
+
+        } else {
+
+            cause = STALL_DEPENDENCE;
+        }
+
+        stall_slots[cause] += missing;
+    }
+
+    retired_this_cycle = 0;
+    sq_full_stall = false;
+}
+
+/**
+ * Enables self-profiling. complete_proc reports host wall time, peak RSS and
+ * simulated instructions and cycles per second, which cost nothing while the
+ * run goes on. Timing each stage with the TSC runs an instrumented loop
+ * instead, so its own rates are not the simulator's.
+ * Must be called before setup_proc.
+ *
+ * @enable True to time the run
+ * @stages True to also time each stage
+ */
+void setup_profiling(bool enable, bool stages)
+{
+    profiling = enable;
+    stage_profiling = stages;
+}
+
+// time stamp counter, or a nanosecond clock where there is none
+static inline uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// sample the IPC of the interval that just ended
+// returns true if the running IPC has converged
+static bool sample_convergence()
+{
+    double ipc = (double) (retired_counter - conv_last_retired) / conv_interval;
+
+    conv_last_retired = retired_counter;
+    conv_countdown = conv_interval;
+    conv_samples++;
+
+    // Welford's running mean and variance
+    double delta = ipc - conv_mean;
+    conv_mean += delta / conv_samples;
+    conv_m2 += delta * (ipc - conv_mean);
+
+    if (conv_samples < CONV_MIN_SAMPLES || conv_mean == 0) {
+        return false;
+    }
+
+    double stddev = sqrt(conv_m2 / (conv_samples - 1));
+    double bound = 1.96 * stddev / sqrt((double) conv_samples);
+
+    return bound <= conv_mean * conv_tolerance / 100.0;
+}
+
+// true while the running thread has flushed instructions left to refetch
+static inline bool refetch_pending()
+{
+    return s != 0 && trailing_inst_tag < inst_tag_counter;
+}
+
+// one cycle of an SMT core, each thread retires, dispatches and frees its
+// own instructions while broadcast, issue and wakeup serve them all
+static void cycle_smt()
+{
+    // the thread that goes first rotates every cycle
+    unsigned int first = cycle_counter % smt_threads;
+    unsigned long waiting[SMT_MAX_THREADS];
+    bool fetchable[SMT_MAX_THREADS];
+    bool settled[SMT_MAX_THREADS];
+    bool settling = false;
+
+    for (unsigned int i = 0; i < smt_threads; ++i) {
+        switch_thread((first + i) % smt_threads);
+        stage_0[s]();
+    }
+
+    // a result only names a register in the map of its own thread
+    unsigned int broadcaster = smt_current;
+    stage_1[s]();
+
+    for (unsigned int t = 0; t < smt_threads; ++t) {
+        if (t != broadcaster) {
+            switch_thread(t);
+            update_reg_file();
+        }
+    }
+
+    stage_2[s]();
+    stage_3[s]();
+
+    uint64_t width = dispatch_width;
+
+    for (unsigned int i = 0; i < smt_threads; ++i) {
+
+        switch_thread((first + i) % smt_threads);
+
+        unsigned long before = sq_size;
+        stage_4[s]();
+        dispatch_width -= sq_size - before;
+    }
+
+    dispatch_width = width;
+
+    for (unsigned int i = 0; i < smt_threads; ++i) {
+
+        unsigned int t = (first + i) % smt_threads;
+        switch_thread(t);
+        stage_5[s]();
+
+        // a thread that cannot fetch leaves the cycle to the others
+        waiting[t] = dq_size;
+        fetchable[t] = cycle_counter >= fetch_ready
+            && dq_size < dq_capacity
+            && (fetch_blocker == nullptr || fetch_blocker->state >= State::EXECUTED)
+            && (!fetch_exhausted || refetch_pending());
+
+        // done with its trace, unless it still has instructions in flight
+        settled[t] = smt_drain_cycle[t] == 0 && dq_size == 0 && !fetch_waiting
+            && fetch_exhausted && !refetch_pending();
+        settling |= settled[t];
+    }
+
+    if (settling) {
+
+        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+            settled[(*iterator)->thread] = false;
+        }
+
+        for (unsigned int t = 0; t < smt_threads; ++t) {
+            if (settled[t]) {
+                smt_drain_cycle[t] = cycle_counter;
+            }
+        }
+    }
+
+    if (fetch_policy == FETCH_ICOUNT) {
+        for (list<proc_inst_t*>::iterator iterator = sq.begin(); iterator != sq.end(); ++iterator) {
+            if ((*iterator)->state == State::DISPATCHED) {
+                waiting[(*iterator)->thread]++;
+            }
+        }
+    }
+
+    unsigned int fetcher = smt_threads;
+
+    for (unsigned int i = 0; i < smt_threads; ++i) {
+
+        unsigned int t = (smt_fetch_next + i) % smt_threads;
+
+        if (fetchable[t] && (fetcher == smt_threads
+                             || (fetch_policy == FETCH_ICOUNT && waiting[t] < waiting[fetcher]))) {
+            fetcher = t;
+        }
+    }
+
+    if (fetcher < smt_threads) {
+        switch_thread(fetcher);
+        stage_6[s]();
+        smt_fetch_next = (fetcher + 1) % smt_threads;
+    }
+}
+
+// true once the window has drained, and with SMT once every thread has
+// also fetched all of its trace, since one may not have fetched this cycle
+static bool drained()
+{
+    if (!(sq.empty() && dq.empty() && !fetch_waiting)) {
+        return false;
+    }
+
+    for (unsigned int t = 0; t < smt_threads && smt_threads > 1; ++t) {
+
+        switch_thread(t);
+
+        if (!dq.empty() || fetch_waiting || !fetch_exhausted || refetch_pending()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Subroutine that simulates the processor.
+ *   The processor should fetch instructions as appropriate, until all instructions have executed
+ * XXX: You're responsible for completing this routine
+ *
+ * @p_stats Pointer to the statistics structure
+ */
+void run_proc(proc_stats_t* p_stats)
+{
+    //log_file << "CYCLE\tOPERATION\tINSTRUCTION\n";
+    bool debug = false;
+
+    run_start = chrono::steady_clock::now();
+
+    do {
+
+        if (smt_threads > 1) {
+
+            cycle_smt();
+
+        } else if (stage_profiling) {
+
+            for (int i = 0; i < 7; ++i) {
+                uint64_t start = read_tsc();
+                stages[i][s]();
+                stage_ticks[i] += read_tsc() - start;
+            }
+
+        } else {
+
+            if (debug) printf("begin stage 0\n");
+            stage_0[s]();
+            if (debug) printf("begin stage 1\n");
+            stage_1[s]();
+            if (debug) printf("begin stage 2\n");
+            stage_2[s]();
+            if (debug) printf("begin stage 3\n");
+            stage_3[s]();
+            if (debug) printf("begin stage 4\n");
+            stage_4[s]();
+            if (debug) printf("begin stage 5\n");
+            stage_5[s]();
+            if (debug) printf("begin stage 6\n");
+            stage_6[s]();
+        }
+
+        cycle_counter++;
+        account_cycle();
+
+        if (tele_interval && --tele_countdown == 0) {
+            sample_telemetry();
+        }
+
+        if (sync_quantum && --sync_countdown == 0) {
+            sync_countdown = sync_quantum;
+            sync_hook();
+        }
+
+        if (conv_interval && --conv_countdown == 0 && sample_convergence()) {
+            p_stats->converged = true;
+            break;
+        }
+
+    } while (!drained());
+}
+
+/**
+ * Subroutine for cleaning up any outstanding instructions and calculating overall statistics
+ * such as average IPC, average fire rate etc.
+ * XXX: You're responsible for completing this routine
+ *
+ * @p_stats Pointer to the statistics structure
+ */
+void complete_proc(proc_stats_t *p_stats) 
+{
+    //log_file.close();
+
+    // the core retires the instructions of every SMT thread
+    unsigned long fetched = 0;
+    uint64_t length = 0;
+    bool length_known = true;
+
+    for (unsigned int t = smt_threads; t-- > 0;) {
+
+        switch_thread(t);
+
+        // CPR only counts instructions once their checkpoint commits, and a
+        // drained window can no longer roll back past its last one
+        if (s == 2 && !p_stats->converged) {
+            retired_counter += inst_tag_counter - 1 - checkpoint(0).inst_tag;
+            smt_retired[t] += inst_tag_counter - 1 - checkpoint(0).inst_tag;
+        }
+
+        p_stats->thread_retired[t] = smt_retired[t];
+        p_stats->thread_cycles[t] = smt_drain_cycle[t] != 0 ? smt_drain_cycle[t] : cycle_counter - 1;
+        fetched += inst_tag_counter - 1;
+        length += trace_length();
+        length_known &= trace_length() != 0;
+    }
+
+    p_stats->smt_threads = smt_threads;
+    inst_tag_counter = fetched + 1;
 
     cycle_counter--;
     inst_tag_counter--;
@@ -1363,12 +2831,13 @@ void complete_proc(proc_stats_t *p_stats)
     rob_hit_counter--;
     reg_hit_counter--;
 
+    // a run that stopped early fetched past what it retired
     p_stats->cycle_count = cycle_counter;
-    p_stats->retired_instruction = inst_tag_counter;
+    p_stats->retired_instruction = retired_counter;
     p_stats->max_disp_size = dq_max_size;
     p_stats->avg_disp_size = (float) (((double) dq_size_sum) / ((double) cycle_counter));
     p_stats->avg_inst_fired = (float) (((double) fired_counter) / ((double) cycle_counter));
-    p_stats->avg_inst_retired = (float) (((double) inst_tag_counter) / ((double) cycle_counter));
+    p_stats->avg_inst_retired = (float) (((double) retired_counter) / ((double) cycle_counter));
     p_stats->reg_file_hit_count = reg_hit_counter;
     p_stats->rob_hit_count = rob_hit_counter;
     p_stats->exception_count = exception_counter;
@@ -1376,24 +2845,96 @@ void complete_proc(proc_stats_t *p_stats)
     p_stats->flushed_count = flushed_counter;
     p_stats->total_hardware = k[0] + k[1] + k[2] + r;
 
+    // retirement timing plus the final counts, so equal digests mean equal runs
+    uint64_t hash = timing_digest;
+    hash = digest(hash, cycle_counter);
+    hash = digest(hash, inst_tag_counter);
+    hash = digest(hash, fired_counter);
+    hash = digest(hash, dq_max_size);
+    hash = digest(hash, dq_size_sum);
+    hash = digest(hash, reg_hit_counter);
+    hash = digest(hash, rob_hit_counter);
+    hash = digest(hash, exception_counter);
+    hash = digest(hash, backup_counter);
+    hash = digest(hash, flushed_counter);
+    p_stats->digest = hash;
+
+    // each cause's share of the CPI, in retire slots of width f
+    for (int i = 0; i < NUM_STALL_CAUSES; ++i) {
+        p_stats->cpi_stack[i] = (float) (((double) stall_slots[i]) / f / ((double) retired_counter));
+    }
+
+    p_stats->icache = icache_sets != 0;
+    p_stats->icache_access_count = icache_access_counter;
+    p_stats->icache_miss_count = icache_miss_counter;
+    bpred_complete(p_stats);
+
+    if (profiling) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - run_start).count();
+
+        p_stats->profiled = true;
+        p_stats->wall_time = seconds;
+        p_stats->sim_inst_per_sec = retired_counter / seconds;
+        p_stats->sim_cycles_per_sec = cycle_counter / seconds;
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        p_stats->max_rss_kb = usage.ru_maxrss;
+    }
+
+    if (stage_profiling) {
+        p_stats->stages_profiled = true;
+        for (int i = 0; i < 7; ++i) {
+            p_stats->stage_ticks[i] = stage_ticks[i];
+        }
+    }
+
+    // a run that stopped early reports the IPC it converged to
+    p_stats->trace_fraction = length_known ? (float) retired_counter / length : -1;
+    p_stats->projected_inst_retired = p_stats->avg_inst_retired;
+    if (p_stats->converged) {
+        p_stats->projected_inst_retired = (float) conv_mean;
+        p_stats->avg_inst_retired = p_stats->projected_inst_retired;
+    }
+
     //print_instructions();
 
-    delete[] reg;
-    delete[] backup_1;
-    delete[] backup_2;
+    if (tele_interval) {
+        flush_telemetry();
+        delete[] tele_ring;
+        tele_ring = nullptr;
+    }
+
+    for (unsigned int t = smt_threads; t-- > 0;) {
+
+        switch_thread(t);
+
+        for (deque<proc_inst_t*>::iterator iterator = instructions.begin(); iterator != instructions.end(); ++iterator) {
+            delete *iterator;
+        }
+        instructions.clear();
+
+        delete[] reg;
+    }
+
+    for (size_t i = 0; i < inst_pool.size(); ++i) {
+        delete inst_pool[i];
+    }
+    inst_pool.clear();
+
     delete[] cdb;
     delete dummy_inst;
 }
 
+// prints the instructions not yet released, those the window may still reach
 void print_instructions()
 {
     printf("INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
 
-    for (list<proc_inst_t*>::iterator iterator = instructions.begin(); iterator != instructions.end(); ++iterator) {
+    for (deque<proc_inst_t*>::iterator iterator = instructions.begin(); iterator != instructions.end(); ++iterator) {
 
         proc_inst_t* inst = *iterator;
-        printf("%d\t%d\t%d\t%d\t%d\t%d\n", inst->inst_tag, inst->fetch, inst->disp, inst->sched, inst->exec, inst->update);
-        delete inst;
+        printf("%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", inst->inst_tag, inst->fetch, inst->disp, inst->sched, inst->exec, inst->update);
     }
 
     printf("\n");
@@ -11,41 +11,151 @@
 #define DEFAULT_F 4
 #define DEFAULT_E 250
 #define DEFAULT_S 0
+#define DEFAULT_T 1.0
+#define DEFAULT_CKPTS 2
 
-enum class State {FETCHED, DISPATCHED, FIRED, EXECUTED, COMPLETED, RETIRED};
+// instructions before the first CPR checkpoint, and between checkpoints
+// when more than two are kept without an interval
+#define DEFAULT_CKPT_INTERVAL 20
+
+// bump whenever a change alters simulated timing or the layout of proc_stats_t,
+// so cached results from older builds are never reused
+#define SIM_VERSION 10
+
+// minimum retirement intervals sampled before a run may stop early
+#define CONV_MIN_SAMPLES 10
+
+// traces an SMT core runs at once
+#define SMT_MAX_THREADS 8
+
+// telemetry samples buffered before they are written out
+#define TELEMETRY_RING_SIZE 4096
+
+enum class State : uint8_t {FETCHED, DISPATCHED, FIRED, EXECUTED, COMPLETED, RETIRED};
+
+// causes a retire slot can be lost to, STALL_BASE counts the slots used
+enum Stall {STALL_BASE, STALL_SQ_FULL, STALL_FU, STALL_BUS, STALL_DEPENDENCE,
+            STALL_EXECUTION, STALL_FRONTEND, STALL_REFILL, NUM_STALL_CAUSES};
+
+// how an SMT core picks the thread that fetches each cycle
+enum FetchPolicy {FETCH_RR, FETCH_ICOUNT, NUM_FETCH_POLICIES};
 
 typedef void (*FP)();
 
+// tags tell apart the results in flight at once, so they may wrap, preg is
+// the physical register holding the result when the register file is bounded
 typedef struct _reg_t
 {
     bool ready = true;
+    uint32_t preg;
     uint32_t tag;
 
 } reg_t;
 
+// map entry a rename overwrote, the first since the newest checkpoint
+typedef struct _journal_entry_t
+{
+    reg_t old;
+    int32_t reg_index;
+
+} journal_entry_t;
+
+// register map after the instruction with inst_tag, 0 for the initial map,
+// kept as the journal position undoing the renames since then, and the
+// epoch registers are stamped with once journaled after it
+typedef struct _checkpoint_t
+{
+    uint64_t inst_tag;
+    uint64_t journal;
+    uint64_t epoch;
+
+} checkpoint_t;
+
+// instruction tags and cycle stamps are 64-bit so long traces never wrap
+// them, register tags are as narrow as in reg_t
+// wide fields come first so the struct packs without holes
 typedef struct _proc_inst_t
 {
+    uint64_t inst_tag;
+
+    uint64_t fetch;
+    uint64_t disp;
+    uint64_t sched;
+    uint64_t exec;
+    uint64_t update;
+
+    // inst_tags of the program-order producers of the sources, 0 for none
+    uint64_t producer[2];
+
+    // consumers of the result, chained through the slot naming this producer
+    struct _proc_inst_t* consumers = nullptr;
+    struct _proc_inst_t* next_consumer[2];
+
+    uint32_t dest_tag;
+    uint32_t src_tag[2];
+
     uint32_t instruction_address;
-    uint32_t inst_tag;
     int32_t op_code;
-    uint32_t fu;
     int32_t dest_reg;
-    uint32_t dest_tag;
     int32_t src_reg[2];
-    uint32_t src_tag[2];
+
+    // physical register of the result and the one it replaced in the map
+    uint32_t preg;
+    uint32_t prev_preg;
+
+    // FU class, and the SMT thread that fetched the instruction
+    uint8_t fu;
+    uint8_t thread = 0;
+
     bool src_ready[2];
-    unsigned long fired_cycle;
     State state;
     bool exception = false;
 
-    uint32_t fetch;
-    uint32_t disp;
-    uint32_t sched;
-    uint32_t exec;
-    uint32_t update;
+    // whether the next instruction in the trace is not the sequential one,
+    // and whether fetch went down the wrong path after this one
+    bool taken;
+    bool mispredict = false;
     
 } proc_inst_t;
 
+// occupancy of the machine at the end of a sampled cycle
+// binary telemetry files are a plain array of these records
+typedef struct _telemetry_sample_t
+{
+    uint64_t cycle;
+    uint32_t dq_size;
+    uint32_t sq_size;
+    uint32_t rob_size;
+    uint32_t sb_size;
+    uint32_t buses_used;
+    uint32_t fu_busy[3];
+    uint32_t retired;
+
+} telemetry_sample_t;
+
+// binary traces start with TRACE_MAGIC, without its terminator,
+// followed by a plain array of these records
+#define TRACE_MAGIC "\x7fPROCSIM"
+
+typedef struct _trace_inst_t
+{
+    uint32_t instruction_address;
+    int32_t op_code;
+    int32_t dest_reg;
+    int32_t src_reg[2];
+
+} trace_inst_t;
+
+// producers of an instruction's sources and whether control leaves it for a
+// non-sequential address, precomputed with the trace since they are the same
+// for every config
+typedef struct _trace_deps_t
+{
+    uint64_t producer[2];
+    bool taken;
+
+} trace_deps_t;
+
 typedef struct _proc_stats_t
 {
     float avg_inst_retired;
@@ -62,11 +172,57 @@ typedef struct _proc_stats_t
     unsigned long flushed_count;
 
     unsigned long total_hardware;
+
+    // instructions each SMT thread retired, and the cycle it drained in
+    unsigned long smt_threads;
+    unsigned long thread_retired[SMT_MAX_THREADS];
+    unsigned long thread_cycles[SMT_MAX_THREADS];
+
+    float cpi_stack[NUM_STALL_CAUSES];
+    uint64_t digest;
+
+    bool profiled;
+    double wall_time;
+    double sim_inst_per_sec;
+    double sim_cycles_per_sec;
+    long max_rss_kb;
+
+    bool stages_profiled;
+    uint64_t stage_ticks[7];
+
+    bool icache;
+    unsigned long icache_access_count;
+    unsigned long icache_miss_count;
+
+    bool bpred;
+    unsigned long branch_count;
+    unsigned long mispredict_count;
+
+    // share of the trace retired before an early stop, negative when the
+    // length of a streamed trace is unknown
+    bool converged;
+    float projected_inst_retired;
+    float trace_fraction;
 } proc_stats_t;
 
 bool read_instruction(proc_inst_t* p_inst);
+void rewind_trace();
+uint64_t trace_length();
+uint64_t trace_hash();
+void select_trace(unsigned int thread);
 
 void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f, uint64_t e, uint64_t s);
+void setup_convergence(uint64_t interval, double tolerance);
+void setup_budget(uint64_t budget);
+void setup_dispatch(uint64_t capacity, uint64_t width);
+void setup_window(uint64_t sq, uint64_t rob, uint64_t prf);
+void setup_checkpoints(uint64_t count, uint64_t interval);
+void setup_smt(uint64_t threads, FetchPolicy policy);
+void setup_sync(FP hook, uint64_t quantum);
+void setup_latency(const uint64_t latency[3], const bool pipelined[3]);
+void setup_icache(uint64_t size, uint64_t line, uint64_t assoc, uint64_t latency);
+void setup_telemetry(FILE* out, uint64_t interval, bool binary);
+void setup_profiling(bool enable, bool stages);
 void run_proc(proc_stats_t* p_stats);
 void complete_proc(proc_stats_t* p_stats);
 void print_instructions();
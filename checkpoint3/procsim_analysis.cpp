@@ -0,0 +1,130 @@
+#include "procsim_analysis.hpp"
+#include <cstring>
+
+//
+// Single pass over a trace that summarizes it before any config is simulated:
+// the op code mix, how far back each source's producer is, and the IPC the
+// dependences alone allow with unlimited FUs, buses and fetch.
+//
+
+// register file size of the traces
+#define NUM_REGS 128
+
+/**
+ * Reads the rest of the input trace and profiles it. Every source depends on the
+ * last earlier instruction that wrote its register, sources with no such writer
+ * are ready from the start. Each dependence is charged the one cycle a result
+ * takes to reach its consumer, so the critical path is the longest chain of
+ * dependent instructions and trace length over it bounds the IPC of any config.
+ *
+ * @p_profile Profile to fill in
+ */
+void analyze_trace(trace_profile_t* p_profile)
+{
+    memset(p_profile, 0, sizeof(trace_profile_t));
+
+    // index and chain depth of the last writer of each register, 0 if none
+    uint64_t writer[NUM_REGS] = {0};
+    uint64_t depth[NUM_REGS] = {0};
+
+    proc_inst_t inst;
+
+    while (read_instruction(&inst)) {
+
+        uint64_t i = ++p_profile->instructions;
+        uint64_t chain = 0;
+
+        p_profile->op_count[inst.op_code + 1]++;
+
+        for (int j = 0; j < 2; ++j) {
+
+            int32_t src = inst.src_reg[j];
+            if (src < 0) {
+                continue;
+            }
+
+            p_profile->sources++;
+
+            if (writer[src] == 0) {
+                p_profile->sources_without_producer++;
+                continue;
+            }
+
+            uint64_t distance = i - writer[src];
+            int bucket = 0;
+            while (bucket < DISTANCE_BUCKETS - 1 && distance >= (2ULL << bucket)) {
+                bucket++;
+            }
+            p_profile->distance[bucket]++;
+
+            if (depth[src] > chain) {
+                chain = depth[src];
+            }
+        }
+
+        chain++;
+
+        if (inst.dest_reg >= 0) {
+            writer[inst.dest_reg] = i;
+            depth[inst.dest_reg] = chain;
+        }
+
+        if (chain > p_profile->critical_path) {
+            p_profile->critical_path = chain;
+        }
+    }
+
+    if (p_profile->critical_path > 0) {
+        p_profile->dataflow_ipc = (float) (((double) p_profile->instructions) / ((double) p_profile->critical_path));
+    }
+}
+
+/**
+ * Prints a trace profile, including the FUs of each type that would be busy every
+ * cycle at the dataflow bound, which caps how many are worth sweeping.
+ *
+ * @p_profile Profile to print
+ * @f Fetch width, which also bounds the IPC
+ */
+void print_trace_profile(const trace_profile_t* p_profile, uint64_t f)
+{
+    double n = p_profile->instructions > 0 ? p_profile->instructions : 1;
+    double sources = p_profile->sources > 0 ? p_profile->sources : 1;
+
+    printf("Trace analysis:\n");
+    printf("Instructions: %lu\n", (unsigned long) p_profile->instructions);
+
+    for (int i = 0; i < 4; ++i) {
+        printf("Op code %d: %lu (%.2f%%)\n", i - 1, (unsigned long) p_profile->op_count[i],
+               100.0 * p_profile->op_count[i] / n);
+    }
+
+    printf("Register sources: %lu\n", (unsigned long) p_profile->sources);
+    printf("Sources without producer: %lu (%.2f%%)\n", (unsigned long) p_profile->sources_without_producer,
+           100.0 * p_profile->sources_without_producer / sources);
+
+    printf("Dependency distance:\n");
+    for (int i = 0; i < DISTANCE_BUCKETS; ++i) {
+
+        if (i == DISTANCE_BUCKETS - 1) {
+            printf("  %7lu+       ", 1UL << i);
+        } else if (i == 0) {
+            printf("  %7d        ", 1);
+        } else {
+            printf("  %7lu-%-7lu", 1UL << i, (2UL << i) - 1);
+        }
+
+        printf("%12lu (%.2f%%)\n", (unsigned long) p_profile->distance[i], 100.0 * p_profile->distance[i] / sources);
+    }
+
+    // op code -1 runs on a k1 FU
+    double k0 = p_profile->op_count[1] / n;
+    double k1 = (p_profile->op_count[0] + p_profile->op_count[2]) / n;
+    double k2 = p_profile->op_count[3] / n;
+    double bound = p_profile->dataflow_ipc < f ? p_profile->dataflow_ipc : f;
+
+    printf("Critical path: %lu\n", (unsigned long) p_profile->critical_path);
+    printf("Dataflow IPC bound: %f\n", p_profile->dataflow_ipc);
+    printf("IPC bound with fetch width %lu: %f\n", (unsigned long) f, bound);
+    printf("FUs busy per cycle at that bound: k0 %.2f, k1 %.2f, k2 %.2f\n", bound * k0, bound * k1, bound * k2);
+}
@@ -0,0 +1,24 @@
+#ifndef PROCSIM_ANALYSIS_HPP
+#define PROCSIM_ANALYSIS_HPP
+
+#include "procsim.hpp"
+
+// dependency distances are bucketed by powers of two, the last bucket is open
+#define DISTANCE_BUCKETS 17
+
+typedef struct _trace_profile_t
+{
+    uint64_t instructions;
+    uint64_t op_count[4];
+    uint64_t sources;
+    uint64_t sources_without_producer;
+    uint64_t distance[DISTANCE_BUCKETS];
+    uint64_t critical_path;
+    float dataflow_ipc;
+
+} trace_profile_t;
+
+void analyze_trace(trace_profile_t* p_profile);
+void print_trace_profile(const trace_profile_t* p_profile, uint64_t f);
+
+#endif /* PROCSIM_ANALYSIS_HPP */
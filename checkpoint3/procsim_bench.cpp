@@ -0,0 +1,208 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <list>
+#include <vector>
+#include "procsim.hpp"
+
+using namespace std;
+
+//
+// Microbenchmarks for the individual stage kernels. Each kernel runs on a
+// synthetic scheduling queue, scoreboard or ROB of a chosen size, so its cost
+// can be measured against window size and bus count without a trace.
+//
+
+// simulator state the benchmarks set up directly
+extern thread_local list<proc_inst_t*> sb;
+extern thread_local list<proc_inst_t*> dq;
+extern thread_local list<proc_inst_t*> sq;
+extern thread_local list<proc_inst_t*> rob;
+extern thread_local unsigned long dq_size;
+extern thread_local unsigned long sq_size;
+extern thread_local proc_inst_t** cdb;
+extern thread_local unsigned long fu_busy_counter[3];
+extern thread_local vector<vector<proc_inst_t*>> completions;
+extern thread_local unsigned long fu_issued[3];
+
+// the kernels never read a trace
+bool read_instruction(proc_inst_t* p_inst) { return false; }
+void rewind_trace() {}
+uint64_t trace_length() { return 0; }
+void select_trace(unsigned int thread) {}
+
+// window of synthetic instructions, each depending on the two before it
+static vector<proc_inst_t> window;
+
+static void make_window(unsigned long size)
+{
+    window.assign(size, proc_inst_t());
+
+    for (unsigned long i = 0; i < size; ++i) {
+
+        proc_inst_t& inst = window[i];
+        inst.instruction_address = 0x10000 + 4 * i;
+        inst.inst_tag = i + 1;
+        inst.op_code = i % 3;
+        inst.fu = i % 3;
+        inst.dest_reg = i % 128;
+        inst.dest_tag = 128 + i;
+        inst.src_reg[0] = (i + 127) % 128;
+        inst.src_reg[1] = (i + 126) % 128;
+        inst.src_tag[0] = 127 + i;
+        inst.src_tag[1] = 126 + i;
+        inst.exec = i;
+        inst.exception = false;
+
+        // chain onto the consumers of the two producers, as fetch does
+        inst.producer[0] = i >= 1 ? i : 0;
+        inst.producer[1] = i >= 2 ? i - 1 : 0;
+
+        for (int k = 0; k < 2; ++k) {
+            if (inst.producer[k] != 0) {
+                proc_inst_t& producer = window[inst.producer[k] - 1];
+                inst.next_consumer[k] = producer.consumers;
+                producer.consumers = &inst;
+            }
+        }
+    }
+}
+
+static void fill(list<proc_inst_t*>& queue, State state)
+{
+    queue.clear();
+
+    for (size_t i = 0; i < window.size(); ++i) {
+        window[i].state = state;
+        queue.push_back(&window[i]);
+    }
+}
+
+// resets the state a kernel consumes, then runs it once
+typedef void (*PREP)(unsigned long buses);
+
+static void prep_wakeup(unsigned long buses)
+{
+    fill(sq, State::DISPATCHED);
+    sq_size = window.size();
+
+    for (size_t i = 0; i < window.size(); ++i) {
+        window[i].src_ready[0] = false;
+        window[i].src_ready[1] = false;
+    }
+
+    // spread the broadcasts across the window
+    for (unsigned long j = 0; j < buses; ++j) {
+        cdb[j] = &window[j * window.size() / buses];
+    }
+}
+
+static void prep_select(unsigned long buses)
+{
+    for (size_t i = 0; i < completions.size(); ++i) {
+        completions[i].clear();
+    }
+
+    fill(sq, State::DISPATCHED);
+    sq_size = window.size();
+    sb.clear();
+
+    for (size_t i = 0; i < window.size(); ++i) {
+        window[i].src_ready[0] = true;
+        window[i].src_ready[1] = true;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        fu_busy_counter[i] = 0;
+        fu_issued[i] = 0;
+    }
+}
+
+static void prep_broadcast(unsigned long buses)
+{
+    fill(sq, State::FIRED);
+    fill(sb, State::FIRED);
+    sq_size = window.size();
+
+    for (int i = 0; i < 3; ++i) {
+        fu_busy_counter[i] = window.size();
+        fu_issued[i] = 0;
+    }
+}
+
+static void prep_dispatch(unsigned long buses)
+{
+    fill(dq, State::FETCHED);
+    dq_size = window.size();
+    sq.clear();
+    sq_size = 0;
+}
+
+static void prep_retire(unsigned long buses)
+{
+    fill(rob, State::COMPLETED);
+    fill(sq, State::COMPLETED);
+    sq_size = window.size();
+}
+
+typedef struct _kernel_t
+{
+    const char* name;
+    FP stage;
+    PREP prep;
+
+} kernel_t;
+
+static const kernel_t kernels[] = {
+    {"wakeup", &cycle_stage_3, &prep_wakeup},
+    {"select", &cycle_stage_2, &prep_select},
+    {"broadcast", &cycle_stage_1, &prep_broadcast},
+    {"dispatch", &cycle_stage_4, &prep_dispatch},
+    {"retire", &cycle_stage_0_rob, &prep_retire},
+};
+
+int main(int argc, char* argv[])
+{
+    const unsigned long windows[] = {8, 32, 128, 512, 2048};
+    const unsigned long buses[] = {1, 4, 16};
+    unsigned long samples = argc > 1 ? atoi(argv[1]) : 200;
+
+    printf("kernel,window,buses,ns_per_call,ns_per_entry\n");
+
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+        for (size_t b = 0; b < sizeof(buses) / sizeof(buses[0]); ++b) {
+
+            // enough FUs that select never runs out
+            proc_stats_t stats;
+            memset(&stats, 0, sizeof(proc_stats_t));
+            setup_proc(buses[b], windows[w], windows[w], windows[w], 4, 0, 1);
+            make_window(windows[w]);
+
+            for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+
+                double total = 0;
+
+                for (unsigned long i = 0; i < samples; ++i) {
+
+                    kernels[k].prep(buses[b]);
+
+                    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                    kernels[k].stage();
+                    total += chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                }
+
+                double ns = total / samples;
+                printf("%s,%lu,%lu,%.1f,%.2f\n", kernels[k].name, windows[w], buses[b], ns, ns / windows[w]);
+            }
+
+            sb.clear();
+            dq.clear();
+            sq.clear();
+            rob.clear();
+            complete_proc(&stats);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include "procsim_bpred.hpp"
+#include <vector>
+
+using namespace std;
+
+//
+// Branch predictors for the fetch stage. A trace only records the path that
+// was taken, so a branch shows up as an instruction whose successor is not the
+// next sequential address, and a branch that falls through looks like any
+// other instruction. A BTB of the PCs seen taken stands in for decode: an
+// instruction that misses in it is predicted to fall through and never touches
+// the predictor or the global history. Predictors train on the outcome as soon
+// as they predict, since the trace holds no wrong-path instructions to run.
+//
+
+// chosen predictor and log2 of its table sizes, shared by all host threads
+// and set before any run starts
+BPred bpred_kind = BPRED_PERFECT;
+uint64_t bpred_bits = BPRED_DEFAULT_BITS;
+
+// tagged TAGE components, each indexed with a longer slice of the history
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 8
+#define TAGE_AGING_PERIOD (1 << 18)
+
+static const int tage_history[TAGE_TABLES] = {4, 8, 16, 32};
+
+typedef struct _tage_entry_t
+{
+    uint16_t tag;
+    int8_t counter;
+    uint8_t useful;
+
+} tage_entry_t;
+
+// PCs known to be branches, direct mapped
+static thread_local vector<uint32_t> btb;
+
+// 2-bit counters of the bimodal and gshare tables and the TAGE base predictor
+static thread_local vector<uint8_t> counters;
+
+static thread_local vector<tage_entry_t> tage[TAGE_TABLES];
+static thread_local uint64_t history;
+static thread_local uint64_t tage_updates;
+
+static thread_local unsigned long branch_counter;
+static thread_local unsigned long mispredict_counter;
+
+static inline uint64_t low_bits(uint64_t value, int bits)
+{
+    return bits >= 64 ? value : value & ((1ULL << bits) - 1);
+}
+
+// the last length outcomes of the history, xor folded down to bits
+static inline uint64_t fold_history(int length, int bits)
+{
+    uint64_t h = low_bits(history, length);
+    uint64_t folded = 0;
+
+    while (h != 0) {
+        folded ^= low_bits(h, bits);
+        h >>= bits;
+    }
+
+    return folded;
+}
+
+// saturating 2-bit counter, predicts taken from 2 up
+static inline void train(uint8_t& counter, bool taken)
+{
+    if (taken && counter < 3) {
+        counter++;
+    } else if (!taken && counter > 0) {
+        counter--;
+    }
+}
+
+static bool tage_predict(uint64_t pc, bool taken)
+{
+    int table_bits = bpred_bits > 6 ? bpred_bits - 2 : 4;
+    uint64_t index[TAGE_TABLES];
+    uint16_t tag[TAGE_TABLES];
+    int provider = -1;
+    int alternate = -1;
+
+    // the longest matching history provides the prediction, the next longest
+    // is the alternate
+    for (int i = TAGE_TABLES - 1; i >= 0; --i) {
+
+        index[i] = low_bits(pc ^ fold_history(tage_history[i], table_bits), table_bits);
+        tag[i] = low_bits((pc >> table_bits) ^ fold_history(tage_history[i], TAGE_TAG_BITS), TAGE_TAG_BITS);
+
+        if (tage[i][index[i]].tag == tag[i]) {
+            if (provider < 0) {
+                provider = i;
+            } else if (alternate < 0) {
+                alternate = i;
+            }
+        }
+    }
+
+    uint8_t& base = counters[low_bits(pc, bpred_bits)];
+    bool base_prediction = base >= 2;
+    bool alternate_prediction = alternate < 0 ? base_prediction : tage[alternate][index[alternate]].counter >= 0;
+    bool prediction = provider < 0 ? base_prediction : tage[provider][index[provider]].counter >= 0;
+
+    if (provider < 0) {
+
+        train(base, taken);
+
+    } else {
+
+        tage_entry_t& entry = tage[provider][index[provider]];
+
+        // an entry is useful when it overrides the alternate correctly
+        if (prediction != alternate_prediction) {
+            if (prediction == taken && entry.useful < 3) {
+                entry.useful++;
+            } else if (prediction != taken && entry.useful > 0) {
+                entry.useful--;
+            }
+        }
+
+        // 3-bit signed counter, predicts taken from 0 up
+        if (taken && entry.counter < 3) {
+            entry.counter++;
+        } else if (!taken && entry.counter > -4) {
+            entry.counter--;
+        }
+    }
+
+    // a misprediction claims an entry in a longer history table, or ages
+    // the entries that could have been claimed
+    if (prediction != taken) {
+
+        bool allocated = false;
+
+        for (int i = provider + 1; i < TAGE_TABLES && !allocated; ++i) {
+
+            tage_entry_t& entry = tage[i][index[i]];
+
+            if (entry.useful == 0) {
+                entry.tag = tag[i];
+                entry.counter = taken ? 0 : -1;
+                allocated = true;
+            }
+        }
+
+        for (int i = provider + 1; i < TAGE_TABLES && !allocated; ++i) {
+            if (tage[i][index[i]].useful > 0) {
+                tage[i][index[i]].useful--;
+            }
+        }
+    }
+
+    if (++tage_updates % TAGE_AGING_PERIOD == 0) {
+        for (int i = 0; i < TAGE_TABLES; ++i) {
+            for (size_t j = 0; j < tage[i].size(); ++j) {
+                tage[i][j].useful >>= 1;
+            }
+        }
+    }
+
+    return prediction;
+}
+
+// predicts a known branch and trains on its outcome
+static bool predict(uint64_t pc, bool taken)
+{
+    bool prediction;
+
+    switch (bpred_kind) {
+    case BPRED_BIMODAL: {
+        uint8_t& counter = counters[low_bits(pc, bpred_bits)];
+        prediction = counter >= 2;
+        train(counter, taken);
+        break;
+    }
+    case BPRED_GSHARE: {
+        uint8_t& counter = counters[low_bits(pc ^ history, bpred_bits)];
+        prediction = counter >= 2;
+        train(counter, taken);
+        break;
+    }
+    case BPRED_TAGE:
+        prediction = tage_predict(pc, taken);
+        break;
+    default:
+        prediction = taken;
+        break;
+    }
+
+    history = (history << 1) | taken;
+
+    return prediction;
+}
+
+/**
+ * Selects the branch predictor fetch consults. Every predictor sits behind a
+ * BTB with as many entries as its own tables. Must be called before any run
+ * starts.
+ *
+ * @kind Predictor, BPRED_PERFECT never mispredicts
+ * @bits Log2 of the entries in each table
+ */
+void setup_bpred(BPred kind, uint64_t bits)
+{
+    bpred_kind = kind;
+    bpred_bits = bits < 4 ? 4 : bits > 24 ? 24 : bits;
+}
+
+// clears the predictor state of this host thread, called from setup_proc
+void bpred_reset()
+{
+    branch_counter = 0;
+    mispredict_counter = 0;
+    history = 0;
+    tage_updates = 0;
+
+    if (bpred_kind == BPRED_PERFECT) {
+        return;
+    }
+
+    // counters start weakly taken, as only PCs seen taken reach them
+    btb.assign(1ULL << bpred_bits, UINT32_MAX);
+    counters.assign(1ULL << bpred_bits, 2);
+
+    if (bpred_kind == BPRED_TAGE) {
+
+        int table_bits = bpred_bits > 6 ? bpred_bits - 2 : 4;
+        tage_entry_t empty = {UINT16_MAX, 0, 0};
+
+        for (int i = 0; i < TAGE_TABLES; ++i) {
+            tage[i].assign(1ULL << table_bits, empty);
+        }
+    }
+}
+
+// returns true if fetch follows the right path after the instruction at pc
+bool bpred_predict(uint32_t pc, bool taken)
+{
+    if (bpred_kind == BPRED_PERFECT) {
+        return true;
+    }
+
+    uint32_t& entry = btb[low_bits(pc >> 2, bpred_bits)];
+
+    // not known as a branch, so fetch falls through
+    if (entry != pc) {
+
+        if (!taken) {
+            return true;
+        }
+
+        entry = pc;
+        predict(pc >> 2, taken);
+
+        branch_counter++;
+        mispredict_counter++;
+        return false;
+    }
+
+    branch_counter++;
+
+    if (predict(pc >> 2, taken) != taken) {
+        mispredict_counter++;
+        return false;
+    }
+
+    return true;
+}
+
+void bpred_complete(proc_stats_t* p_stats)
+{
+    p_stats->bpred = bpred_kind != BPRED_PERFECT;
+    p_stats->branch_count = branch_counter;
+    p_stats->mispredict_count = mispredict_counter;
+}
@@ -0,0 +1,19 @@
+#ifndef PROCSIM_BPRED_HPP
+#define PROCSIM_BPRED_HPP
+
+#include "procsim.hpp"
+
+enum BPred {BPRED_PERFECT, BPRED_BIMODAL, BPRED_GSHARE, BPRED_TAGE, NUM_BPREDS};
+
+// log2 of the entries in each predictor table and the BTB
+#define BPRED_DEFAULT_BITS 12
+
+// chosen predictor, shared by all host threads and set before any run starts
+extern BPred bpred_kind;
+
+void setup_bpred(BPred kind, uint64_t bits);
+void bpred_reset();
+bool bpred_predict(uint32_t pc, bool taken);
+void bpred_complete(proc_stats_t* p_stats);
+
+#endif /* PROCSIM_BPRED_HPP */
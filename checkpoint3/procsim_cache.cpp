@@ -0,0 +1,168 @@
+#include "procsim_cache.hpp"
+#include "procsim_bpred.hpp"
+#include <cstring>
+#include <cinttypes>
+#include <string>
+#include <thread>
+#include <functional>
+#include <unistd.h>
+
+using namespace std;
+
+//
+// On-disk cache of simulation results. Each result is a file named after the
+// hash of its key, holding the key followed by the raw proc_stats_t. Files are
+// written under a unique temporary name and renamed into place, so parallel
+// workers and processes sharing a directory never see a partial entry, and two
+// writers racing on the same key just store the same result twice.
+//
+
+// run settings that change results, owned by the simulator
+extern thread_local uint64_t inst_budget;
+extern thread_local uint64_t conv_interval;
+extern thread_local double conv_tolerance;
+extern uint64_t fu_latency[3];
+extern bool fu_pipelined[3];
+extern uint64_t icache_sets;
+extern uint64_t icache_assoc;
+extern uint64_t icache_line_bits;
+extern uint64_t icache_latency;
+extern uint64_t bpred_bits;
+
+// shared by every host thread, set once before any simulation
+static string cache_dir;
+
+static cache_key_t make_key(const proc_config_t& config)
+{
+    cache_key_t key;
+    memset(&key, 0, sizeof(cache_key_t));
+
+    key.version = SIM_VERSION;
+    key.stats_size = sizeof(proc_stats_t);
+    key.trace = trace_hash();
+    key.r = config.r;
+    key.k0 = config.k0;
+    key.k1 = config.k1;
+    key.k2 = config.k2;
+    key.f = config.f;
+    key.e = config.e;
+    key.s = config.s;
+    key.q = config.q;
+    key.d = config.d;
+    key.sq = config.sq;
+    key.rob = config.rob;
+    key.prf = config.prf;
+    key.ckpts = config.ckpts;
+    key.ckpt_interval = config.ckpt_interval;
+    for (int i = 0; i < 3; ++i) {
+        key.latency[i] = fu_latency[i];
+        key.unpipelined |= (uint64_t) !fu_pipelined[i] << i;
+    }
+    if (icache_sets != 0) {
+        key.icache_sets = icache_sets;
+        key.icache_assoc = icache_assoc;
+        key.icache_line_bits = icache_line_bits;
+        key.icache_latency = icache_latency;
+    }
+    if (bpred_kind != BPRED_PERFECT) {
+        key.bpred_kind = bpred_kind;
+        key.bpred_bits = bpred_bits;
+    }
+    key.budget = inst_budget;
+    key.interval = conv_interval;
+    key.tolerance = conv_interval ? conv_tolerance : 0;
+
+    return key;
+}
+
+static string entry_path(const cache_key_t& key)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char* bytes = (const unsigned char*) &key;
+
+    for (size_t i = 0; i < sizeof(cache_key_t); ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".stats", hash);
+
+    return cache_dir + name;
+}
+
+/**
+ * Enables the result cache. Results are only cached for buffered traces, since
+ * the key needs the hash of the whole trace before the run starts.
+ *
+ * @dir Existing directory to keep results in, nullptr to disable the cache
+ */
+void setup_cache(const char* dir)
+{
+    cache_dir = dir == nullptr ? "" : dir;
+}
+
+bool cache_enabled()
+{
+    return !cache_dir.empty();
+}
+
+/**
+ * Looks up the result of simulating a config on the current trace.
+ *
+ * @config Config to look up
+ * @p_stats Filled in with the cached result on a hit
+ * @return true on a hit
+ */
+bool cache_lookup(const proc_config_t& config, proc_stats_t* p_stats)
+{
+    if (!cache_enabled()) {
+        return false;
+    }
+
+    cache_key_t key = make_key(config);
+    FILE* entry = fopen(entry_path(key).c_str(), "rb");
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    cache_key_t stored;
+    bool hit = fread(&stored, sizeof(cache_key_t), 1, entry) == 1
+        && memcmp(&stored, &key, sizeof(cache_key_t)) == 0
+        && fread(p_stats, sizeof(proc_stats_t), 1, entry) == 1;
+
+    fclose(entry);
+    return hit;
+}
+
+/**
+ * Stores the result of simulating a config on the current trace.
+ *
+ * @config Config that was simulated
+ * @p_stats Its completed statistics
+ */
+void cache_store(const proc_config_t& config, const proc_stats_t* p_stats)
+{
+    if (!cache_enabled()) {
+        return;
+    }
+
+    cache_key_t key = make_key(config);
+    string path = entry_path(key);
+
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%ld.%zx.tmp", (long) getpid(), hash<thread::id>()(this_thread::get_id()));
+    string temp = path + suffix;
+
+    FILE* entry = fopen(temp.c_str(), "wb");
+    if (entry == NULL) {
+        return;
+    }
+
+    bool written = fwrite(&key, sizeof(cache_key_t), 1, entry) == 1
+        && fwrite(p_stats, sizeof(proc_stats_t), 1, entry) == 1;
+
+    if (fclose(entry) != 0 || !written || rename(temp.c_str(), path.c_str()) != 0) {
+        remove(temp.c_str());
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PROCSIM_CACHE_HPP
+#define PROCSIM_CACHE_HPP
+
+#include "procsim.hpp"
+#include "procsim_sweep.hpp"
+
+// everything a cached result depends on, stored at the head of its file
+typedef struct _cache_key_t
+{
+    uint64_t version;
+    uint64_t stats_size;
+    uint64_t trace;
+    uint64_t r;
+    uint64_t k0;
+    uint64_t k1;
+    uint64_t k2;
+    uint64_t f;
+    uint64_t e;
+    uint64_t s;
+    uint64_t q;
+    uint64_t d;
+    uint64_t sq;
+    uint64_t rob;
+    uint64_t prf;
+    uint64_t ckpts;
+    uint64_t ckpt_interval;
+    uint64_t latency[3];
+    uint64_t unpipelined;
+    uint64_t icache_sets;
+    uint64_t icache_assoc;
+    uint64_t icache_line_bits;
+    uint64_t icache_latency;
+    uint64_t bpred_kind;
+    uint64_t bpred_bits;
+    uint64_t budget;
+    uint64_t interval;
+    double tolerance;
+
+} cache_key_t;
+
+void setup_cache(const char* dir);
+bool cache_enabled();
+bool cache_lookup(const proc_config_t& config, proc_stats_t* p_stats);
+void cache_store(const proc_config_t& config, const proc_stats_t* p_stats);
+
+#endif /* PROCSIM_CACHE_HPP */
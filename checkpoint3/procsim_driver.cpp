@@ -4,12 +4,75 @@
 #include <cstring>
 #include <unistd.h>
 #include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
 #include "procsim.hpp"
+#include "procsim_sweep.hpp"
+#include "procsim_analysis.hpp"
+#include "procsim_cache.hpp"
+#include "procsim_bpred.hpp"
 
-FILE* inFile = stdin;
+// input and trace buffers are per host thread, like the simulator state
+thread_local FILE* inFile = stdin;
+
+// format of the input, decided by its first byte
+thread_local bool trace_format_known = false;
+thread_local bool trace_binary = false;
+
+// trace held in memory for modes that simulate it more than once
+thread_local std::vector<trace_inst_t> trace;
+thread_local size_t trace_pos = 0;
+thread_local bool trace_buffered = false;
+
+// producers of each buffered instruction's sources, found once per trace
+thread_local std::vector<trace_deps_t> trace_deps;
+
+// last writer of each register, for finding producers while streaming
+thread_local uint64_t trace_writer[128];
+thread_local uint64_t trace_read = 0;
+thread_local uint64_t trace_content_hash;
+
+// record after the one being streamed, read ahead to tell if control leaves it
+thread_local trace_inst_t trace_next;
+thread_local bool trace_next_valid = false;
+thread_local bool trace_started = false;
+
+// barrier the cores of a multicore run meet at, a core leaves it once it
+// has drained so the others never wait on it
+static std::mutex sync_mutex;
+static std::condition_variable sync_met;
+static unsigned long sync_running;
+static unsigned long sync_arrived;
+static unsigned long sync_generation;
+
+// buffered trace of an SMT thread, the selected thread's is swapped into
+// trace, trace_deps and trace_pos and its own slot left empty
+typedef struct _smt_trace_t
+{
+    std::vector<trace_inst_t> trace;
+    std::vector<trace_deps_t> deps;
+    size_t pos = 0;
+
+} smt_trace_t;
+
+thread_local std::vector<smt_trace_t> smt_traces;
+thread_local unsigned int smt_trace_selected = 0;
+
+// one trace of a batch run
+typedef struct _batch_run_t
+{
+    std::string path;
+    double weight;
+    proc_stats_t stats;
+
+} batch_run_t;
 
 void print_help_and_exit(void) {
-    printf("procsim [OPTIONS]\n");
+    printf("procsim [OPTIONS] [trace[:weight] ...]\n");
     printf("  -j k0\t\tNumber of k0 FUs\n");
     printf("  -k k1\t\tNumber of k1 FUs\n");
     printf("  -l k2\t\tNumber of k2 FUs\n");   
@@ -18,10 +81,109 @@ void print_help_and_exit(void) {
     printf("  -e E\t\tException rate\n");
     printf("  -s S\t\tException repair scheme\n");
     printf("  -i traces/file.trace\n");
+    printf("  -w N\t\tStop once the IPC sampled every N cycles converges\n");
+    printf("  -t T\t\tConvergence tolerance in percent of IPC (default %.1f)\n", DEFAULT_T);
+    printf("  -T file\tWrite occupancy telemetry to file, raw records if\n");
+    printf("    \t\tit ends in .bin and CSV otherwise\n");
+    printf("  -u N\t\tSample telemetry every N cycles (default 1)\n");
+    printf("  -b\t\tReport host wall time, simulation rate and peak RSS\n");
+    printf("  -p\t\tBreak host time down per stage, slowing the run\n");
+    printf("  -o file\tAppend the result line to file (default gcc.csv)\n");
+    printf("  -d\t\tPrint the timing digest for equivalence checks\n");
+    printf("  -v\t\tPrint statistics\n");
+    printf("  -n N\t\tSimulate only the first N instructions\n");
+    printf("  -a T\t\tSearch for the cheapest config within T%% of peak IPC,\n");
+    printf("    \t\tbounded above by the -j/-k/-l/-f/-r values\n");
+    printf("  -H eta\tSearch by successive halving on trace prefixes\n");
+    printf("    \t\tgrowing by eta instead of coordinate descent\n");
+    printf("  -q N\t\tDispatch queue entries, fetch stalls when it is full\n");
+    printf("    \t\t(default 0, unbounded)\n");
+    printf("  -D N\t\tInstructions dispatched per cycle (default 0, as many\n");
+    printf("    \t\tas the scheduling queue takes)\n");
+    printf("  -S N\t\tScheduling queue entries (default 0, 2 per FU)\n");
+    printf("  -R N\t\tReorder buffer entries (default 0, unbounded)\n");
+    printf("  -P N\t\tPhysical registers, more than 128, renamed through a\n");
+    printf("    \t\tfree list (default 0, unbounded)\n");
+    printf("  -Q N\t\tRun the listed traces as the cores of one chip,\n");
+    printf("    \t\tmeeting every N cycles, and report its throughput\n");
+    printf("  -m a,b,...\tRun up to %d traces as SMT threads of one core\n", SMT_MAX_THREADS);
+    printf("  -F p\t\tSMT fetch policy, rr or icount (default icount)\n");
+    printf("  -c N\t\tCheckpoints CPR keeps, at least 2 (default %d)\n", DEFAULT_CKPTS);
+    printf("  -g N\t\tInstructions between CPR checkpoints (default 0, taken\n");
+    printf("    \t\tat the scheduling queue tail, or %d past 2 checkpoints)\n", DEFAULT_CKPT_INTERVAL);
+    printf("  -x a,b,c\tExecution latency of k0, k1 and k2 FUs (default 1,1,1)\n");
+    printf("  -U list\tFU classes that are not pipelined, e.g. 2 or 1,2\n");
+    printf("  -I s,l,a,m\tI-cache of s bytes, l byte lines, a ways and an m\n");
+    printf("    \t\tcycle miss latency, sizes powers of two (default perfect)\n");
+    printf("  -B p[,b]\tBranch predictor p, one of perfect, bimodal, gshare\n");
+    printf("    \t\tor tage, with 2^b entry tables (default perfect,%d)\n", BPRED_DEFAULT_BITS);
+    printf("  -C dir\t\tReuse results cached in dir and cache new ones\n");
+    printf("  -A\t\tAnalyze the trace instead of simulating it: FU mix,\n");
+    printf("    \t\tdependency distances and the dataflow IPC bound\n");
     printf("  -h\t\tThis helpful output\n");
+    printf("  Traces listed after the options are simulated in parallel and\n");
+    printf("  summarized with IPC means weighted by the optional :weight.\n");
+    printf("  Traces may be text or binary as written by tracegen -b.\n");
     exit(0);
 }
 
+//
+// read_record
+//
+//  reads the next record of the input trace, text or binary
+//
+static bool read_record(trace_inst_t* t)
+{
+    if (!trace_format_known) {
+
+        trace_format_known = true;
+
+        int c = getc(inFile);
+        if (c == TRACE_MAGIC[0]) {
+
+            char magic[sizeof(TRACE_MAGIC) - 1];
+            magic[0] = c;
+            if (fread(magic + 1, 1, sizeof(magic) - 1, inFile) != sizeof(magic) - 1
+                || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+                fprintf(stderr, "Unrecognized binary trace header\n");
+                return false;
+            }
+            trace_binary = true;
+
+        } else if (c != EOF) {
+            ungetc(c, inFile);
+        }
+    }
+
+    if (trace_binary) {
+        return fread(t, sizeof(trace_inst_t), 1, inFile) == 1;
+    }
+
+    return fscanf(inFile, "%x %d %d %d %d\n", &t->instruction_address,
+                  &t->op_code, &t->dest_reg, &t->src_reg[0], &t->src_reg[1]) == 5;
+}
+
+//
+// find_producers
+//
+//  fills in the inst_tags of the instructions producing the sources of the
+//  instruction with the given inst_tag, given every earlier instruction
+//
+static void find_producers(const trace_inst_t* t, uint64_t tag, trace_deps_t* deps)
+{
+    if (tag == 1) {
+        memset(trace_writer, 0, sizeof(trace_writer));
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        deps->producer[i] = t->src_reg[i] < 0 ? 0 : trace_writer[t->src_reg[i]];
+    }
+
+    if (t->dest_reg >= 0) {
+        trace_writer[t->dest_reg] = tag;
+    }
+}
+
 //
 // read_instruction
 //
@@ -29,25 +191,372 @@ void print_help_and_exit(void) {
 //
 bool read_instruction(proc_inst_t* p_inst)
 {
-    int ret;
-    
     if (p_inst == NULL)
     {
         fprintf(stderr, "Fetch requires a valid pointer to populate\n");
         return false;
     }
     
-    ret = fscanf(stdin, "%x %d %d %d %d\n", &p_inst->instruction_address,
-                 &p_inst->op_code, &p_inst->dest_reg, &p_inst->src_reg[0], &p_inst->src_reg[1]); 
-    if (ret != 5) {
-        return false;
+    trace_inst_t record;
+    trace_deps_t record_deps;
+    const trace_inst_t* t = &record;
+    const trace_deps_t* deps = &record_deps;
+
+    if (trace_buffered) {
+
+        if (trace_pos == trace.size()) {
+            return false;
+        }
+
+        deps = &trace_deps[trace_pos];
+        t = &trace[trace_pos++];
+
+    } else {
+
+        if (!trace_started) {
+            trace_started = true;
+            trace_next_valid = read_record(&trace_next);
+        }
+
+        if (!trace_next_valid) {
+            return false;
+        }
+
+        record = trace_next;
+        trace_next_valid = read_record(&trace_next);
+
+        find_producers(&record, ++trace_read, &record_deps);
+        record_deps.taken = trace_next_valid
+            && trace_next.instruction_address != record.instruction_address + 4;
     }
+
+    p_inst->instruction_address = t->instruction_address;
+    p_inst->op_code = t->op_code;
+    p_inst->dest_reg = t->dest_reg;
+    p_inst->src_reg[0] = t->src_reg[0];
+    p_inst->src_reg[1] = t->src_reg[1];
+    p_inst->producer[0] = deps->producer[0];
+    p_inst->producer[1] = deps->producer[1];
+    p_inst->taken = deps->taken;
     
     return true;
 }
 
+//
+// load_trace
+//
+//  reads the whole input trace into memory so it can be simulated repeatedly
+//
+void load_trace()
+{
+    trace_inst_t t;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    // word-wise FNV-1a over the fields, so text and binary traces hash alike
+    while (read_record(&t)) {
+        trace.push_back(t);
+
+        trace_deps_t deps;
+        find_producers(&t, trace.size(), &deps);
+        deps.taken = false;
+        trace_deps.push_back(deps);
+
+        if (trace.size() > 1) {
+            trace_deps[trace.size() - 2].taken = t.instruction_address != trace[trace.size() - 2].instruction_address + 4;
+        }
+
+        hash = (hash ^ t.instruction_address) * 0x100000001b3ULL;
+        hash = (hash ^ (uint32_t) t.op_code) * 0x100000001b3ULL;
+        hash = (hash ^ (uint32_t) t.dest_reg) * 0x100000001b3ULL;
+        hash = (hash ^ (uint32_t) t.src_reg[0]) * 0x100000001b3ULL;
+        hash = (hash ^ (uint32_t) t.src_reg[1]) * 0x100000001b3ULL;
+    }
+
+    trace_content_hash = hash;
+
+    trace_buffered = true;
+    trace_pos = 0;
+}
+
+//
+// trace_length
+//
+//  returns the number of instructions in a buffered trace, or 0 if the
+//  trace is streamed
+//
+uint64_t trace_length()
+{
+    return trace.size();
+}
+
+//
+// trace_hash
+//
+//  returns a hash of the contents of a buffered trace
+//
+uint64_t trace_hash()
+{
+    return trace_content_hash;
+}
+
+//
+// select_trace
+//
+//  makes read_instruction read the buffered trace of an SMT thread
+//
+void select_trace(unsigned int thread)
+{
+    if (smt_traces.empty() || thread == smt_trace_selected) {
+        return;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        smt_trace_t& slot = smt_traces[i == 0 ? smt_trace_selected : thread];
+        std::swap(trace, slot.trace);
+        std::swap(trace_deps, slot.deps);
+        std::swap(trace_pos, slot.pos);
+    }
+
+    smt_trace_selected = thread;
+}
+
+//
+// load_smt_traces
+//
+//  buffers each trace of a comma separated list for an SMT thread of its own,
+//  returning how many there are
+//
+static unsigned int load_smt_traces(char* list)
+{
+    unsigned int threads = 0;
+
+    for (char* path = strtok(list, ","); path != NULL; path = strtok(NULL, ",")) {
+
+        if (threads == SMT_MAX_THREADS) {
+            print_help_and_exit();
+        }
+
+        inFile = fopen(path, "r");
+        if (inFile == NULL) {
+            fprintf(stderr, "Failed to open %s for reading\n", path);
+            print_help_and_exit();
+        }
+
+        smt_traces.resize(threads + 1);
+        select_trace(threads++);
+
+        trace_format_known = false;
+        trace_binary = false;
+        load_trace();
+        fclose(inFile);
+    }
+
+    select_trace(0);
+    inFile = stdin;
+
+    return threads;
+}
+
+//
+// rewind_trace
+//
+//  restarts a buffered trace from its first instruction
+//
+void rewind_trace()
+{
+    trace_pos = 0;
+}
+
 void print_statistics(proc_stats_t* p_stats);
 
+//
+// run_batch
+//
+//  simulates the same config on several traces, one host thread per trace,
+//  and reports each trace plus weighted means of their IPC
+//
+void run_batch(std::vector<batch_run_t>& runs, const proc_config_t& config, uint64_t w, double t, uint64_t n, bool verbose)
+{
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+
+        batch_run_t* run = &runs[i];
+
+        threads.push_back(std::thread([run, config, w, t, n]() {
+            inFile = fopen(run->path.c_str(), "r");
+            setup_convergence(w, t);
+            setup_budget(n);
+
+            // the cache key needs the whole trace
+            if (cache_enabled()) {
+                load_trace();
+            }
+            simulate(config, &run->stats);
+            fclose(inFile);
+        }));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    double weights = 0;
+    double arithmetic = 0;
+    double harmonic = 0;
+    double geometric = 0;
+
+    printf("%-32s %10s %12s %12s %8s\n", "TRACE", "IPC", "CYCLES", "INSTS", "WEIGHT");
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+
+        const batch_run_t& run = runs[i];
+        double ipc = run.stats.avg_inst_retired;
+
+        printf("%-32s %10f %12lu %12lu %8.3f\n", run.path.c_str(), ipc,
+               run.stats.cycle_count, run.stats.retired_instruction, run.weight);
+
+        weights += run.weight;
+        arithmetic += run.weight * ipc;
+        harmonic += run.weight / ipc;
+        geometric += run.weight * log(ipc);
+    }
+
+    printf("\n");
+    printf("Arithmetic mean IPC: %f\n", arithmetic / weights);
+    printf("Harmonic mean IPC: %f\n", weights / harmonic);
+    printf("Geometric mean IPC: %f\n", exp(geometric / weights));
+
+    if (verbose) {
+        for (size_t i = 0; i < runs.size(); ++i) {
+            printf("\n%s\n", runs[i].path.c_str());
+            print_statistics(&runs[i].stats);
+        }
+    }
+}
+
+// releases the cores waiting at the barrier
+static void release_cores()
+{
+    sync_arrived = 0;
+    sync_generation++;
+    sync_met.notify_all();
+}
+
+// waits until every core still running reaches the barrier
+static void sync_cores()
+{
+    std::unique_lock<std::mutex> lock(sync_mutex);
+    unsigned long generation = sync_generation;
+
+    if (++sync_arrived == sync_running) {
+        release_cores();
+    } else {
+        sync_met.wait(lock, [generation]() { return generation != sync_generation; });
+    }
+}
+
+// drops a drained core from the barrier, which the others may now be done at
+static void leave_cores()
+{
+    std::lock_guard<std::mutex> lock(sync_mutex);
+
+    if (--sync_running == sync_arrived && sync_arrived > 0) {
+        release_cores();
+    }
+}
+
+//
+// run_multicore
+//
+//  simulates each trace on a core of its own, one host thread per core,
+//  with the cores meeting every quantum cycles, and reports the throughput
+//  of the whole chip
+//
+void run_multicore(std::vector<batch_run_t>& runs, const proc_config_t& config, uint64_t quantum, uint64_t w, double t, uint64_t n, bool verbose)
+{
+    std::vector<std::thread> threads;
+    std::vector<FILE*> files;
+
+    // a core that could not start would hold the others at the barrier
+    for (size_t i = 0; i < runs.size(); ++i) {
+
+        files.push_back(fopen(runs[i].path.c_str(), "r"));
+        if (files[i] == NULL) {
+            fprintf(stderr, "Failed to open %s for reading\n", runs[i].path.c_str());
+            print_help_and_exit();
+        }
+    }
+
+    sync_running = runs.size();
+    sync_arrived = 0;
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+
+        batch_run_t* run = &runs[i];
+        FILE* file = files[i];
+
+        threads.push_back(std::thread([run, file, config, quantum, w, t, n]() {
+            inFile = file;
+            memset(&run->stats, 0, sizeof(proc_stats_t));
+
+            // an early stop reports the share of the trace it simulated
+            if (w > 0) {
+                load_trace();
+            }
+
+            setup_convergence(w, t);
+            setup_budget(n);
+            setup_sync(&sync_cores, quantum);
+            setup_dispatch(config.q, config.d);
+            setup_window(config.sq, config.rob, config.prf);
+            setup_checkpoints(config.ckpts, config.ckpt_interval);
+            setup_proc(config.r, config.k0, config.k1, config.k2, config.f, config.e, config.s);
+            run_proc(&run->stats);
+            leave_cores();
+            complete_proc(&run->stats);
+            fclose(inFile);
+        }));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    unsigned long instructions = 0;
+    unsigned long cycles = 0;
+    unsigned long hardware = 0;
+
+    printf("%-6s %-32s %10s %12s %12s\n", "CORE", "TRACE", "IPC", "CYCLES", "INSTS");
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+
+        const batch_run_t& run = runs[i];
+
+        printf("%-6lu %-32s %10f %12lu %12lu\n", (unsigned long) i, run.path.c_str(), run.stats.avg_inst_retired,
+               run.stats.cycle_count, run.stats.retired_instruction);
+
+        instructions += run.stats.retired_instruction;
+        cycles = run.stats.cycle_count > cycles ? run.stats.cycle_count : cycles;
+        hardware += run.stats.total_hardware;
+    }
+
+    // the chip is done once its slowest core is
+    printf("\n");
+    printf("Cores: %lu\n", (unsigned long) runs.size());
+    printf("Total instructions: %lu\n", instructions);
+    printf("Total run time (cycles): %lu\n", cycles);
+    printf("Throughput IPC: %f\n", (double) instructions / cycles);
+    printf("Total hardware: %lu\n", hardware);
+
+    if (verbose) {
+        for (size_t i = 0; i < runs.size(); ++i) {
+            printf("\n%s\n", runs[i].path.c_str());
+            print_statistics(&runs[i].stats);
+        }
+    }
+}
+
 int main(int argc, char* argv[]) {
     int opt;
     uint64_t f = DEFAULT_F;
@@ -57,9 +566,37 @@ int main(int argc, char* argv[]) {
     uint64_t r = DEFAULT_R;
     uint64_t e = DEFAULT_E;
     uint64_t s = DEFAULT_S;
+    uint64_t q = 0;
+    uint64_t d = 0;
+    uint64_t sq = 0;
+    uint64_t rob = 0;
+    uint64_t prf = 0;
+    uint64_t ckpts = 0;
+    uint64_t ckpt_interval = 0;
+    char* smt_list = nullptr;
+    FetchPolicy fetch = FETCH_ICOUNT;
+    uint64_t a = 0;
+    uint64_t n = 0;
+    uint64_t eta = 0;
+    uint64_t w = 0;
+    uint64_t quantum = 0;
+    double t = DEFAULT_T;
+    bool verbose = false;
+    bool profile = false;
+    bool profile_stages = false;
+    bool digest = false;
+    bool analyze = false;
+    uint64_t latency[3] = {1, 1, 1};
+    bool pipelined[3] = {true, true, true};
+    uint64_t icache[4] = {0, 64, 1, 0};
+    BPred bpred = BPRED_PERFECT;
+    uint64_t bpred_bits = BPRED_DEFAULT_BITS;
+    const char* output = "gcc.csv";
+    const char* telemetry = nullptr;
+    uint64_t u = 1;
 
     /* Read arguments */ 
-    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:e:s:h"))) {
+    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:e:s:q:D:S:R:P:c:g:m:F:Q:n:a:H:w:t:T:u:bpo:dvAC:x:U:I:B:h"))) {
         switch(opt) {
         case 'r':
             r = atoi(optarg);
@@ -82,6 +619,123 @@ int main(int argc, char* argv[]) {
         case 's':
             s = atoi(optarg);
             break;
+        case 'q':
+            q = atoi(optarg);
+            break;
+        case 'D':
+            d = atoi(optarg);
+            break;
+        case 'S':
+            sq = atoi(optarg);
+            break;
+        case 'R':
+            rob = atoi(optarg);
+            break;
+        case 'P':
+            prf = atoi(optarg);
+            if (prf != 0 && prf <= 128) {
+                print_help_and_exit();
+            }
+            break;
+        case 'c':
+            ckpts = atoi(optarg);
+            break;
+        case 'g':
+            ckpt_interval = atoi(optarg);
+            break;
+        case 'm':
+            smt_list = optarg;
+            break;
+        case 'Q':
+            quantum = atoi(optarg);
+            break;
+        case 'F':
+            if (strcmp(optarg, "rr") == 0) {
+                fetch = FETCH_RR;
+            } else if (strcmp(optarg, "icount") == 0) {
+                fetch = FETCH_ICOUNT;
+            } else {
+                print_help_and_exit();
+            }
+            break;
+        case 'a':
+            a = atoi(optarg);
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'H':
+            eta = atoi(optarg);
+            break;
+        case 'w':
+            w = atoi(optarg);
+            break;
+        case 't':
+            t = atof(optarg);
+            break;
+        case 'T':
+            telemetry = optarg;
+            break;
+        case 'u':
+            u = atoi(optarg);
+            break;
+        case 'b':
+            profile = true;
+            break;
+        case 'p':
+            profile_stages = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            digest = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'A':
+            analyze = true;
+            break;
+        case 'C':
+            setup_cache(optarg);
+            break;
+        case 'x':
+            if (sscanf(optarg, "%" SCNu64 ",%" SCNu64 ",%" SCNu64, &latency[0], &latency[1], &latency[2]) != 3) {
+                print_help_and_exit();
+            }
+            break;
+        case 'I':
+            if (sscanf(optarg, "%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%" SCNu64,
+                       &icache[0], &icache[1], &icache[2], &icache[3]) != 4
+                || icache[1] == 0 || icache[2] == 0
+                || (icache[0] & (icache[0] - 1)) || (icache[1] & (icache[1] - 1)) || (icache[2] & (icache[2] - 1))
+                || (icache[0] > 0 && icache[0] < icache[1] * icache[2])) {
+                print_help_and_exit();
+            }
+            break;
+        case 'B': {
+            const char* names[NUM_BPREDS] = {"perfect", "bimodal", "gshare", "tage"};
+            size_t len = strcspn(optarg, ",");
+            int kind = 0;
+
+            while (kind < NUM_BPREDS && (strlen(names[kind]) != len || strncmp(optarg, names[kind], len) != 0)) {
+                kind++;
+            }
+            if (kind == NUM_BPREDS
+                || (optarg[len] == ',' && sscanf(optarg + len + 1, "%" SCNu64, &bpred_bits) != 1)) {
+                print_help_and_exit();
+            }
+            bpred = (BPred) kind;
+            break;
+        }
+        case 'U':
+            for (const char* c = optarg; *c != '\0'; ++c) {
+                if (*c >= '0' && *c <= '2') {
+                    pipelined[*c - '0'] = false;
+                }
+            }
+            break;
         case 'i':
             inFile = fopen(optarg, "r");
             if (inFile == NULL)
@@ -108,23 +762,166 @@ int main(int argc, char* argv[]) {
     printf("S: %"  PRIu64 "\n", s);
     printf("\n");*/
 
-    /* Setup the processor */
-    setup_proc(r, k0, k1, k2, f, e, s);
+    setup_latency(latency, pipelined);
+    setup_icache(icache[0], icache[1], icache[2], icache[3]);
+    setup_bpred(bpred, bpred_bits);
+
+    /* Profile the trace instead of simulating it */
+    if (analyze) {
+        trace_profile_t profile;
+
+        if (optind == argc) {
+            analyze_trace(&profile);
+            print_trace_profile(&profile, f);
+        }
+
+        for (int i = optind; i < argc; ++i) {
+            inFile = fopen(argv[i], "r");
+            if (inFile == NULL) {
+                fprintf(stderr, "Failed to open %s for reading\n", argv[i]);
+                print_help_and_exit();
+            }
+            trace_format_known = false;
+            trace_binary = false;
+            trace_read = 0;
+            trace_started = false;
+
+            printf("%s%s\n", i > optind ? "\n" : "", argv[i]);
+            analyze_trace(&profile);
+            print_trace_profile(&profile, f);
+            fclose(inFile);
+        }
+        return 0;
+    }
+
+    /* Run the traces as threads of one SMT core */
+    if (smt_list != nullptr) {
+
+        unsigned int threads = load_smt_traces(smt_list);
+
+        // every thread keeps its own architectural registers
+        if (optind < argc || a > 0 || (prf != 0 && prf <= 128 * threads)) {
+            print_help_and_exit();
+        }
+
+        setup_smt(threads, fetch);
+    }
+
+    /* Simulate every trace listed after the options in parallel */
+    if (optind < argc) {
+
+        std::vector<batch_run_t> runs;
+
+        for (int i = optind; i < argc; ++i) {
+
+            batch_run_t run;
+            run.path = argv[i];
+            run.weight = 1;
+
+            // trailing :weight, if it parses as a number
+            size_t colon = run.path.rfind(':');
+            if (colon != std::string::npos) {
+                char* end;
+                double weight = strtod(run.path.c_str() + colon + 1, &end);
+                if (*end == '\0' && end != run.path.c_str() + colon + 1) {
+                    run.weight = weight;
+                    run.path.erase(colon);
+                }
+            }
+
+            if (access(run.path.c_str(), R_OK) != 0) {
+                fprintf(stderr, "Failed to open %s for reading\n", run.path.c_str());
+                print_help_and_exit();
+            }
+
+            runs.push_back(run);
+        }
+
+        proc_config_t config = {r, k0, k1, k2, f, e, s, q, d, sq, rob, prf, ckpts, ckpt_interval};
+        if (quantum > 0) {
+            run_multicore(runs, config, quantum, w, t, n, verbose);
+        } else {
+            run_batch(runs, config, w, t, n, verbose);
+        }
+        return 0;
+    }
+
+    setup_convergence(w, t);
+    setup_budget(n);
+
+    /* Search the design space instead of running a single config */
+    if (a > 0) {
+        proc_config_t bounds = {r, k0, k1, k2, f, e, s, q, d, sq, rob, prf, ckpts, ckpt_interval};
+        load_trace();
+
+        if (eta > 1) {
+            uint64_t length = trace_length();
+            successive_halving(bounds, a, eta, n > 0 && n < length ? n : length);
+        } else {
+            adaptive_search(bounds, a);
+        }
+        return 0;
+    }
+
+    /* Setup telemetry */
+    FILE* telemetry_file = nullptr;
+    if (telemetry != nullptr) {
+        size_t len = strlen(telemetry);
+        bool binary = len >= 4 && strcmp(telemetry + len - 4, ".bin") == 0;
+
+        telemetry_file = fopen(telemetry, binary ? "wb" : "w");
+        if (telemetry_file == NULL) {
+            fprintf(stderr, "Failed to open %s for writing\n", telemetry);
+            print_help_and_exit();
+        }
+        setup_telemetry(telemetry_file, u, binary);
+    }
 
     /* Setup statistics */
     proc_stats_t stats;
     memset(&stats, 0, sizeof(proc_stats_t));
 
-    /* Run the processor */
-    run_proc(&stats);
+    if (cache_enabled() && telemetry_file == nullptr && !profile && !profile_stages && smt_list == nullptr) {
+
+        /* Reuse a cached result, or simulate and cache it */
+        proc_config_t config = {r, k0, k1, k2, f, e, s, q, d, sq, rob, prf, ckpts, ckpt_interval};
+        load_trace();
+        simulate(config, &stats);
+
+    } else {
+
+        /* An early stop reports the share of the trace it simulated */
+        if (w > 0 && smt_list == nullptr) {
+            load_trace();
+        }
 
-    /* Finalize stats */
-    complete_proc(&stats);
+        /* Setup the processor */
+        setup_profiling(profile, profile_stages);
+        setup_dispatch(q, d);
+        setup_window(sq, rob, prf);
+        setup_checkpoints(ckpts, ckpt_interval);
+        setup_proc(r, k0, k1, k2, f, e, s);
+
+        /* Run the processor */
+        run_proc(&stats);
+
+        /* Finalize stats */
+        complete_proc(&stats);
+    }
+
+    if (telemetry_file != nullptr) {
+        fclose(telemetry_file);
+    }
 
     //print_statistics(&stats);
+    if (verbose) {
+        print_statistics(&stats);
+    } else if (digest) {
+        printf("Timing digest: %016" PRIx64 "\n", stats.digest);
+    }
     std::ofstream outfile;
 
-    outfile.open("gcc.csv", std::ios_base::app);
+    outfile.open(output, std::ios_base::app);
     outfile << stats.avg_inst_retired << "," << stats.total_hardware << "," << r << "," << k0 << "," << k1 << "," << k2 << "," << f << "," << s << "\n"; 
 
     outfile.close();
@@ -144,7 +941,67 @@ void print_statistics(proc_stats_t* p_stats) {
 	printf("Total register file hits: %lu\n", p_stats->reg_file_hit_count);
     printf("Total ROB hits: %lu\n", p_stats->rob_hit_count);
     printf("Total exceptions: %lu\n", p_stats->exception_count);
-    printf("Total B1 to B2 backups: %lu\n", p_stats->backup_count);
+    printf("Total checkpoint commits: %lu\n", p_stats->backup_count);
     printf("Total flushed instructions: %lu\n", p_stats->flushed_count);
+
+    printf("Timing digest: %016" PRIx64 "\n", p_stats->digest);
+
+    if (p_stats->smt_threads > 1) {
+        for (unsigned long i = 0; i < p_stats->smt_threads; ++i) {
+            printf("Thread %lu instructions: %lu (IPC %f over its %lu cycles)\n", i, p_stats->thread_retired[i],
+                   (double) p_stats->thread_retired[i] / p_stats->thread_cycles[i], p_stats->thread_cycles[i]);
+        }
+    }
+
+    const char* causes[NUM_STALL_CAUSES] = {"Base", "Scheduling queue full", "No free FU",
+        "Result bus contention", "Operand dependence", "Multi-cycle FU", "Front end", "Exception refill"};
+    float cpi = 0;
+
+    printf("CPI stack:\n");
+    for (int i = 0; i < NUM_STALL_CAUSES; ++i) {
+        printf("  %-24s%f\n", causes[i], p_stats->cpi_stack[i]);
+        cpi += p_stats->cpi_stack[i];
+    }
+    printf("  %-24s%f\n", "Total", cpi);
+
+    if (p_stats->icache) {
+        printf("I-cache line accesses: %lu\n", p_stats->icache_access_count);
+        printf("I-cache misses: %lu (%.2f%%)\n", p_stats->icache_miss_count,
+               p_stats->icache_access_count == 0 ? 0.0 : 100.0 * p_stats->icache_miss_count / p_stats->icache_access_count);
+    }
+
+    if (p_stats->bpred) {
+        printf("Branches predicted: %lu\n", p_stats->branch_count);
+        printf("Branch mispredictions: %lu (%.2f%%)\n", p_stats->mispredict_count,
+               p_stats->branch_count == 0 ? 0.0 : 100.0 * p_stats->mispredict_count / p_stats->branch_count);
+    }
+
+    if (p_stats->profiled) {
+        printf("Host wall time (s): %f\n", p_stats->wall_time);
+        printf("Simulated instructions per second: %.0f\n", p_stats->sim_inst_per_sec);
+        printf("Simulated cycles per second: %.0f\n", p_stats->sim_cycles_per_sec);
+        printf("Peak RSS (KB): %ld\n", p_stats->max_rss_kb);
+    }
+
+    if (p_stats->stages_profiled) {
+        uint64_t ticks = 0;
+        for (int i = 0; i < 7; ++i) {
+            ticks += p_stats->stage_ticks[i];
+        }
+
+        for (int i = 0; i < 7; ++i) {
+            printf("Stage %d ticks: %" PRIu64 " (%.1f%%)\n", i, p_stats->stage_ticks[i],
+                   ticks == 0 ? 0.0 : 100.0 * p_stats->stage_ticks[i] / ticks);
+        }
+    }
+
+    if (p_stats->converged) {
+        printf("Projected inst retired per cycle: %f\n", p_stats->projected_inst_retired);
+        if (p_stats->trace_fraction < 0) {
+            printf("Fraction of trace simulated: unknown\n");
+        } else {
+            printf("Fraction of trace simulated: %f\n", p_stats->trace_fraction);
+        }
+    }
 }
 
@@ -0,0 +1,404 @@
+#include "procsim_sweep.hpp"
+#include "procsim_cache.hpp"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+//==================//
+// Shared Utilities //
+//==================//
+
+// results simulate fetched from the cache instead of simulating
+static thread_local unsigned long cache_hits;
+
+// simulate one configuration over the buffered trace, or fetch the result from the cache
+float simulate(const proc_config_t& config, proc_stats_t* p_stats)
+{
+    rewind_trace();
+    memset(p_stats, 0, sizeof(proc_stats_t));
+
+    if (cache_lookup(config, p_stats)) {
+        cache_hits++;
+        return p_stats->avg_inst_retired;
+    }
+
+    setup_dispatch(config.q, config.d);
+    setup_window(config.sq, config.rob, config.prf);
+    setup_checkpoints(config.ckpts, config.ckpt_interval);
+    setup_proc(config.r, config.k0, config.k1, config.k2, config.f, config.e, config.s);
+    run_proc(p_stats);
+    complete_proc(p_stats);
+
+    cache_store(config, p_stats);
+
+    return p_stats->avg_inst_retired;
+}
+
+// points the exhaustive sweep in ./script visits below the bounds
+// k0, k1 and k2 run from 1, f steps down by 4 and r never exceeds the FU count
+vector<proc_config_t> enumerate_grid(const proc_config_t& bounds)
+{
+    vector<proc_config_t> grid;
+
+    for (uint64_t k0 = 1; k0 <= bounds.k0; ++k0) {
+        for (uint64_t k1 = 1; k1 <= bounds.k1; ++k1) {
+            for (uint64_t k2 = 1; k2 <= bounds.k2; ++k2) {
+                for (uint64_t f = bounds.f; f >= 1 && f <= bounds.f; f -= 4) {
+
+                    uint64_t fus = k0 + k1 + k2;
+                    uint64_t buses = bounds.r < fus ? bounds.r : fus;
+
+                    for (uint64_t r = 1; r <= buses; ++r) {
+                        proc_config_t c = {r, k0, k1, k2, f, bounds.e, bounds.s, bounds.q, bounds.d,
+                                            bounds.sq, bounds.rob, bounds.prf, bounds.ckpts, bounds.ckpt_interval};
+                        grid.push_back(c);
+                    }
+                }
+            }
+        }
+    }
+
+    return grid;
+}
+
+unsigned long grid_size(const proc_config_t& bounds)
+{
+    return enumerate_grid(bounds).size();
+}
+
+// the front end and window sizes of a best config, when it sets any
+static void print_window(const proc_config_t& c)
+{
+    if (c.q != 0 || c.d != 0 || c.sq != 0 || c.rob != 0 || c.prf != 0) {
+        printf("Best window: -q %lu -D %lu -S %lu -R %lu -P %lu\n", (unsigned long) c.q, (unsigned long) c.d,
+               (unsigned long) c.sq, (unsigned long) c.rob, (unsigned long) c.prf);
+    }
+}
+
+static unsigned long hardware(const proc_config_t& c)
+{
+    return c.k0 + c.k1 + c.k2 + c.r;
+}
+
+// window sizes are 0 when unbounded, the largest they can be
+static inline bool no_larger(uint64_t x, uint64_t y)
+{
+    return y == 0 || (x != 0 && x <= y);
+}
+
+// true if every resource in x is no larger than in y
+static bool dominated(const proc_config_t& x, const proc_config_t& y)
+{
+    return x.k0 <= y.k0 && x.k1 <= y.k1 && x.k2 <= y.k2 && x.r <= y.r && x.f <= y.f
+        && no_larger(x.q, y.q) && no_larger(x.d, y.d) && no_larger(x.sq, y.sq)
+        && no_larger(x.rob, y.rob) && no_larger(x.prf, y.prf);
+}
+
+//=================//
+// Adaptive Search //
+//=================//
+
+// configs that fell below the target, used to prune anything they dominate
+static thread_local vector<proc_config_t> failures;
+static thread_local unsigned long runs;
+static thread_local unsigned long pruned;
+
+// returns the IPC of a config, or -1 if it is known to miss the target
+// assumes adding resources never lowers IPC, so a config smaller than a failure fails too
+static float evaluate(const proc_config_t& c, float target_ipc)
+{
+    for (size_t i = 0; i < failures.size(); ++i) {
+        if (dominated(c, failures[i])) {
+            pruned++;
+            return -1;
+        }
+    }
+
+    proc_stats_t stats;
+    float ipc = simulate(c, &stats);
+    runs++;
+
+    if (ipc < target_ipc) {
+        failures.push_back(c);
+        return -1;
+    }
+
+    return ipc;
+}
+
+/**
+ * Coordinate descent from the largest config towards the cheapest one that still
+ * reaches target percent of the peak IPC. Each step removes one FU or result bus,
+ * keeping whichever removal loses the least IPC, and stops once every removal
+ * drops below the target. The fetch width is trimmed last since it is not counted
+ * in total_hardware.
+ *
+ * @bounds Largest config in the search space
+ * @target Percent of peak IPC the result must reach
+ */
+void adaptive_search(const proc_config_t& bounds, uint64_t target)
+{
+    failures.clear();
+    runs = 0;
+    pruned = 0;
+    cache_hits = 0;
+
+    proc_stats_t stats;
+    float peak = simulate(bounds, &stats);
+    float target_ipc = peak * target / 100.0f;
+    runs++;
+
+    proc_config_t best = bounds;
+    float best_ipc = peak;
+
+    while (true) {
+
+        proc_config_t step = best;
+        float step_ipc = -1;
+
+        for (int d = 0; d < 4; ++d) {
+
+            proc_config_t c = best;
+            uint64_t* field[4] = {&c.k0, &c.k1, &c.k2, &c.r};
+
+            if (*field[d] <= 1) {
+                continue;
+            }
+
+            (*field[d])--;
+
+            // result buses beyond the FU count are never used
+            if (c.r > c.k0 + c.k1 + c.k2) {
+                c.r = c.k0 + c.k1 + c.k2;
+            }
+
+            float ipc = evaluate(c, target_ipc);
+
+            if (ipc > step_ipc) {
+                step = c;
+                step_ipc = ipc;
+            }
+        }
+
+        if (step_ipc < 0) {
+            break;
+        }
+
+        best = step;
+        best_ipc = step_ipc;
+    }
+
+    while (best.f > 4) {
+
+        proc_config_t c = best;
+        c.f -= 4;
+
+        float ipc = evaluate(c, target_ipc);
+
+        if (ipc < 0) {
+            break;
+        }
+
+        best = c;
+        best_ipc = ipc;
+    }
+
+    // then each bounded window structure, halving it while the target still
+    // holds, the register file only ever loses rename registers
+    for (int d = 0; d < 4; ++d) {
+
+        while (true) {
+
+            proc_config_t c = best;
+            uint64_t* field[4] = {&c.q, &c.sq, &c.rob, &c.prf};
+            uint64_t floor = d == 3 ? 128 : 0;
+
+            if (*field[d] <= floor + 1) {
+                break;
+            }
+
+            *field[d] = floor + (*field[d] - floor) / 2;
+
+            float ipc = evaluate(c, target_ipc);
+
+            if (ipc < 0) {
+                break;
+            }
+
+            best = c;
+            best_ipc = ipc;
+        }
+    }
+
+    // configs evaluated either ran or came from the cache
+    unsigned long grid = grid_size(bounds);
+    unsigned long simulated = runs - cache_hits;
+    unsigned long saved = simulated < grid ? grid - simulated : 0;
+
+    printf("Search results:\n");
+    printf("Peak IPC: %f\n", peak);
+    printf("Target IPC: %f (%lu%% of peak)\n", target_ipc, (unsigned long) target);
+    printf("Best config: -j %lu -k %lu -l %lu -f %lu -r %lu -s %lu\n",
+           (unsigned long) best.k0, (unsigned long) best.k1, (unsigned long) best.k2,
+           (unsigned long) best.f, (unsigned long) best.r, (unsigned long) best.s);
+    print_window(best);
+    printf("Best IPC: %f\n", best_ipc);
+    printf("Total hardware: %lu\n", hardware(best));
+    printf("Simulations run: %lu\n", simulated);
+    printf("Cached results: %lu\n", cache_hits);
+    printf("Simulations pruned: %lu\n", pruned);
+    printf("Exhaustive grid size: %lu\n", grid);
+    printf("Simulations saved: %lu (%.1f%%)\n", saved, 100.0 * saved / grid);
+}
+
+//====================//
+// Successive Halving //
+//====================//
+
+typedef struct _candidate_t
+{
+    proc_config_t config;
+    float ipc;
+
+} candidate_t;
+
+/**
+ * Multi-fidelity search for the cheapest config within target percent of peak IPC.
+ * Every grid point is first simulated on a short prefix of the trace. Configs that
+ * clearly miss the target, or that a no more expensive config clearly beats, are
+ * dropped, and the survivors are rerun on a prefix eta times longer until the last
+ * round runs the full trace. "Clearly" allows HALVING_SLACK percent for the error
+ * of ranking on a prefix.
+ *
+ * @bounds Largest config in the search space
+ * @target Percent of peak IPC the result must reach
+ * @eta Growth factor of the prefix between rounds
+ * @length Number of instructions in the full trace
+ */
+void successive_halving(const proc_config_t& bounds, uint64_t target, uint64_t eta, uint64_t length)
+{
+    vector<candidate_t> survivors;
+    vector<proc_config_t> grid = enumerate_grid(bounds);
+
+    for (size_t i = 0; i < grid.size(); ++i) {
+        candidate_t c = {grid[i], 0};
+        survivors.push_back(c);
+    }
+
+    // round i runs a prefix of length / eta^i, starting from the
+    // shortest prefix that is still worth ranking on
+    uint64_t scale = 1;
+    while (length / (scale * eta) >= HALVING_MIN_BUDGET) {
+        scale *= eta;
+    }
+
+    unsigned long runs = 0;
+    uint64_t simulated = 0;
+    float slack = HALVING_SLACK / 100.0f;
+    cache_hits = 0;
+
+    printf("Successive halving:\n");
+
+    while (true) {
+
+        uint64_t budget = length / scale;
+        setup_budget(budget);
+
+        float best = 0;
+        for (size_t i = 0; i < survivors.size(); ++i) {
+
+            proc_stats_t stats;
+            unsigned long hits = cache_hits;
+            survivors[i].ipc = simulate(survivors[i].config, &stats);
+
+            if (cache_hits == hits) {
+                simulated += stats.retired_instruction;
+                runs++;
+            }
+
+            if (survivors[i].ipc > best) {
+                best = survivors[i].ipc;
+            }
+        }
+
+        printf("Prefix %lu: %lu configs\n", (unsigned long) budget, (unsigned long) survivors.size());
+
+        if (scale == 1) {
+            break;
+        }
+
+        float cutoff = best * target / 100.0f * (1 - slack);
+        vector<candidate_t> kept;
+
+        for (size_t i = 0; i < survivors.size(); ++i) {
+
+            const candidate_t& x = survivors[i];
+            bool keep = x.ipc >= cutoff;
+
+            for (size_t j = 0; keep && j < survivors.size(); ++j) {
+
+                const candidate_t& y = survivors[j];
+
+                if (j != i
+                    && hardware(y.config) <= hardware(x.config)
+                    && y.ipc > x.ipc * (1 + slack)) {
+
+                    keep = false;
+                }
+            }
+
+            if (keep) {
+                kept.push_back(x);
+            }
+        }
+
+        survivors = kept;
+        scale /= eta;
+    }
+
+    setup_budget(length);
+
+    // cheapest full-trace survivor that reaches the target
+    float peak = 0;
+    for (size_t i = 0; i < survivors.size(); ++i) {
+        if (survivors[i].ipc > peak) {
+            peak = survivors[i].ipc;
+        }
+    }
+
+    float target_ipc = peak * target / 100.0f;
+    candidate_t best = survivors[0];
+
+    for (size_t i = 0; i < survivors.size(); ++i) {
+
+        const candidate_t& x = survivors[i];
+
+        if (x.ipc < target_ipc) {
+            continue;
+        }
+
+        if (best.ipc < target_ipc
+            || hardware(x.config) < hardware(best.config)
+            || (hardware(x.config) == hardware(best.config) && x.ipc > best.ipc)) {
+
+            best = x;
+        }
+    }
+
+    uint64_t exhaustive = (uint64_t) grid.size() * length;
+
+    printf("Peak IPC: %f\n", peak);
+    printf("Target IPC: %f (%lu%% of peak)\n", target_ipc, (unsigned long) target);
+    printf("Best config: -j %lu -k %lu -l %lu -f %lu -r %lu -s %lu\n",
+           (unsigned long) best.config.k0, (unsigned long) best.config.k1, (unsigned long) best.config.k2,
+           (unsigned long) best.config.f, (unsigned long) best.config.r, (unsigned long) best.config.s);
+    print_window(best.config);
+    printf("Best IPC: %f\n", best.ipc);
+    printf("Total hardware: %lu\n", hardware(best.config));
+    printf("Simulations run: %lu\n", runs);
+    printf("Cached results: %lu\n", cache_hits);
+    printf("Exhaustive grid size: %lu\n", (unsigned long) grid.size());
+    printf("Instructions simulated: %lu of %lu (%.1f%%)\n", (unsigned long) simulated,
+           (unsigned long) exhaustive, 100.0 * simulated / exhaustive);
+}
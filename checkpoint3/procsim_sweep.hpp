@@ -0,0 +1,46 @@
+#ifndef PROCSIM_SWEEP_HPP
+#define PROCSIM_SWEEP_HPP
+
+#include "procsim.hpp"
+#include <vector>
+
+typedef struct _proc_config_t
+{
+    uint64_t r;
+    uint64_t k0;
+    uint64_t k1;
+    uint64_t k2;
+    uint64_t f;
+    uint64_t e;
+    uint64_t s;
+
+    // dispatch queue capacity and dispatch width, 0 for no limit
+    uint64_t q;
+    uint64_t d;
+
+    // scheduling queue, reorder buffer and physical register file sizes,
+    // 0 for the defaults
+    uint64_t sq;
+    uint64_t rob;
+    uint64_t prf;
+
+    // CPR checkpoints and instructions between them, 0 for the defaults
+    uint64_t ckpts;
+    uint64_t ckpt_interval;
+
+} proc_config_t;
+
+// prefixes shorter than this are too noisy to rank configs on
+#define HALVING_MIN_BUDGET 5000
+
+// percent of IPC by which a prefix ranking may be wrong
+#define HALVING_SLACK 2
+
+float simulate(const proc_config_t& config, proc_stats_t* p_stats);
+std::vector<proc_config_t> enumerate_grid(const proc_config_t& bounds);
+unsigned long grid_size(const proc_config_t& bounds);
+
+void adaptive_search(const proc_config_t& bounds, uint64_t target);
+void successive_halving(const proc_config_t& bounds, uint64_t target, uint64_t eta, uint64_t length);
+
+#endif /* PROCSIM_SWEEP_HPP */
@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+#include <random>
+#include <vector>
+#include "procsim.hpp"
+
+//
+// Synthetic trace generator. Writes traces of any length in the text format
+// the bundled traces use, or in the binary format the simulator also reads,
+// with control over the FU mix, dependency distances, register pressure and
+// loop structure of the instruction addresses. The same seed always produces
+// the same trace.
+//
+
+// sources look back at most this many instructions for a producer
+#define MAX_DISTANCE 4096
+
+// distances drawn for a source before it reads the nearest live result instead
+#define MAX_DRAWS 64
+
+// address of the first instruction, loops start on fresh lines past it
+#define BASE_ADDRESS 0x10000
+
+void print_help_and_exit(void) {
+    printf("tracegen [OPTIONS]\n");
+    printf("  -n N\t\tNumber of instructions (default 100000)\n");
+    printf("  -m a,b,c,d\tRelative weights of op codes -1, 0, 1 and 2\n");
+    printf("  -d D\t\tMean dependency distance in instructions (default 8),\n");
+    printf("    \t\tin effect capped near -R / -q since registers are rewritten\n");
+    printf("  -p P\t\tPercent of sources that read a register (default 50)\n");
+    printf("  -q P\t\tPercent of instructions that write a register (default 55)\n");
+    printf("  -R N\t\tNumber of registers in use, 1 to 128 (default 32)\n");
+    printf("  -L N\t\tLoop body length in instructions, 0 for straight-line code\n");
+    printf("  -I N\t\tIterations of each loop (default 100)\n");
+    printf("  -S seed\tRandom seed (default 1)\n");
+    printf("  -b\t\tWrite the binary format\n");
+    printf("  -o file\tOutput file (default stdout)\n");
+    printf("  -h\t\tThis helpful output\n");
+    exit(0);
+}
+
+static std::mt19937_64 rng;
+
+// uniform in [0, 1), computed here so traces do not depend on the C++ library
+static double uniform()
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// geometric distance of at least 1 with the given mean
+static uint64_t distance(double mean)
+{
+    if (mean <= 1) {
+        return 1;
+    }
+
+    return 1 + (uint64_t) (log(1 - uniform()) / log(1 - 1 / mean));
+}
+
+// address of the last of n instructions, computed wide since trace
+// addresses are 32 bits and long traces would wrap them
+static uint64_t last_address(uint64_t n, uint64_t loop, uint64_t iterations)
+{
+    if (loop == 0) {
+        return BASE_ADDRESS + 4 * (n - 1);
+    }
+
+    uint64_t blocks = iterations == 0 ? 0 : (n - 1) / loop / iterations;
+
+    return BASE_ADDRESS + blocks * ((4 * loop + 63) & ~63ULL) + 4 * ((n - 1) % loop);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    uint64_t n = 100000;
+    double weights[4] = {22, 54, 8, 16};
+    double d = 8;
+    double p = 50;
+    double q = 55;
+    uint64_t regs = 32;
+    uint64_t loop = 0;
+    uint64_t iterations = 100;
+    uint64_t seed = 1;
+    bool binary = false;
+    FILE* out = stdout;
+
+    while(-1 != (opt = getopt(argc, argv, "n:m:d:p:q:R:L:I:S:bo:h"))) {
+        switch(opt) {
+        case 'n':
+            n = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &weights[0], &weights[1], &weights[2], &weights[3]) != 4) {
+                print_help_and_exit();
+            }
+            break;
+        case 'd':
+            d = atof(optarg);
+            break;
+        case 'p':
+            p = atof(optarg);
+            break;
+        case 'q':
+            q = atof(optarg);
+            break;
+        case 'R':
+            regs = atoi(optarg);
+            if (regs < 1 || regs > 128) {
+                print_help_and_exit();
+            }
+            break;
+        case 'L':
+            loop = atoi(optarg);
+            break;
+        case 'I':
+            iterations = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            binary = true;
+            break;
+        case 'o':
+            out = fopen(optarg, "wb");
+            if (out == NULL) {
+                fprintf(stderr, "Failed to open %s for writing\n", optarg);
+                print_help_and_exit();
+            }
+            break;
+        case 'h':
+            /* Fall through */
+        default:
+            print_help_and_exit();
+            break;
+        }
+    }
+
+    if (n > 0 && last_address(n, loop, iterations) > UINT32_MAX) {
+        fprintf(stderr, "Addresses of %" PRIu64 " instructions overflow 32 bits, use fewer or loop with -L and -I\n", n);
+        exit(1);
+    }
+
+    rng.seed(seed);
+
+    double total = weights[0] + weights[1] + weights[2] + weights[3];
+
+    // destination register of the last MAX_DISTANCE instructions, and the
+    // instruction that last wrote each register
+    std::vector<int32_t> dests(MAX_DISTANCE, -1);
+    std::vector<uint64_t> writer(128, UINT64_MAX);
+
+    // loops start on fresh lines so they do not alias each other
+    uint64_t base = BASE_ADDRESS;
+    uint64_t position = 0;
+    uint64_t iteration = 0;
+
+    if (binary) {
+        fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC) - 1, out);
+    }
+
+    for (uint64_t i = 0; i < n; ++i) {
+
+        trace_inst_t t;
+
+        // address
+        if (loop == 0) {
+            t.instruction_address = base + 4 * i;
+        } else {
+            t.instruction_address = base + 4 * position;
+            if (++position == loop) {
+                position = 0;
+                if (++iteration == iterations) {
+                    iteration = 0;
+                    base += (4 * loop + 63) & ~63;
+                }
+            }
+        }
+
+        // op code
+        double pick = uniform() * total;
+        int op = 0;
+        while (op < 3 && pick >= weights[op]) {
+            pick -= weights[op];
+            op++;
+        }
+        t.op_code = op - 1;
+
+        // sources read the result of the instruction a distance back, drawn
+        // again until that one wrote a register not rewritten since, so the
+        // distances are those asked for up to how long a result stays live
+        for (int j = 0; j < 2; ++j) {
+
+            t.src_reg[j] = -1;
+
+            if (uniform() * 100 < p) {
+
+                int32_t reg = -1;
+
+                for (int draw = 0; draw < MAX_DRAWS && reg < 0; ++draw) {
+
+                    uint64_t back = distance(d);
+
+                    if (back <= i && back <= MAX_DISTANCE) {
+                        int32_t candidate = dests[(i - back) % MAX_DISTANCE];
+                        if (candidate >= 0 && writer[candidate] == i - back) {
+                            reg = candidate;
+                        }
+                    }
+                }
+
+                for (uint64_t back = 1; reg < 0 && back <= i && back <= MAX_DISTANCE; ++back) {
+                    int32_t candidate = dests[(i - back) % MAX_DISTANCE];
+                    if (candidate >= 0 && writer[candidate] == i - back) {
+                        reg = candidate;
+                    }
+                }
+
+                t.src_reg[j] = reg >= 0 ? reg : (int32_t) (rng() % regs);
+            }
+        }
+
+        t.dest_reg = uniform() * 100 < q ? (int32_t) (rng() % regs) : -1;
+        dests[i % MAX_DISTANCE] = t.dest_reg;
+        if (t.dest_reg >= 0) {
+            writer[t.dest_reg] = i;
+        }
+
+        if (binary) {
+            fwrite(&t, sizeof(trace_inst_t), 1, out);
+        } else {
+            fprintf(out, "%x %d %d %d %d\n", t.instruction_address, t.op_code,
+                    t.dest_reg, t.src_reg[0], t.src_reg[1]);
+        }
+    }
+
+    fclose(out);
+    return 0;
+}